@@ -0,0 +1,733 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+#include "key_search.h"
+#include "node_keys.h"
+
+namespace b_tree {
+
+// A B+ tree: all the values live in the leaves, which are linked into a
+// list in key order, and internal nodes only hold copies of keys to
+// separate their children. Scans walk the leaf list without going back up
+// the tree, at the cost of the separator copies and of lookups always
+// going all the way down.
+template<std::copyable T, size_t Order, typename Comparator = std::less<>, typename Allocator = std::allocator<T>>
+class BPlusTree {
+    static_assert(Order > 1, "Order must be greater than 1");
+
+    static constexpr size_t max_children = Order * 2;
+    static constexpr size_t max_keys = max_children - 1;
+    static constexpr size_t min_children = Order;
+    static constexpr size_t min_keys = min_children - 1;
+
+    static_assert(min_keys != 0);
+
+    // See BTree::max_height.
+    static constexpr size_t max_height = [] {
+        size_t height = 2;
+        for (size_t nodes = 2; nodes < SIZE_MAX / min_children; nodes *= min_children) {
+            ++height;
+        }
+        return height;
+    }();
+
+    struct Leaf;
+    struct InternalNode;
+    class NodeFactory;
+
+    // See BTree::lookup_key.
+    template<typename K>
+    static constexpr bool lookup_key = std::same_as<K, T> || requires { typename Comparator::is_transparent; };
+
+    // Separator i of an internal node is no less than the keys under child
+    // i and no greater than those under child i + 1. Equal keys may end up
+    // on both sides of a separator.
+    struct Node : detail::NodeKeys<T, max_keys> {
+    private:
+        Node() noexcept = default;  // a leaf
+
+        [[nodiscard]] Leaf *as_leaf() noexcept {
+            assert(this->is_leaf_node());
+            return static_cast<Leaf *>(this);
+        }
+
+        [[nodiscard]] InternalNode *as_internal() noexcept {
+            assert(this->is_internal_node());
+            return static_cast<InternalNode *>(this);
+        }
+
+        [[nodiscard]] InternalNode const *as_internal() const noexcept {
+            assert(this->is_internal_node());
+            return static_cast<InternalNode const *>(this);
+        }
+
+        [[nodiscard]] Node *child(size_t index) const noexcept {
+            return as_internal()->children_[index];
+        }
+
+        friend class BPlusTree;
+        friend struct Leaf;
+        friend struct InternalNode;
+        friend class NodeFactory;
+    };
+
+    struct Leaf : Node {
+    private:
+        Leaf() noexcept = default;
+
+        // Keys of the other leaf go after the ones of this one.
+        void append(Leaf *other) noexcept {
+            Node::relocate(this->keys_ + this->key_num_, other->keys_, other->key_num_);
+            this->key_num_ += other->key_num_;
+            other->key_num_ = 0;
+        }
+
+        Leaf *prev_ = nullptr;
+        Leaf *next_ = nullptr;
+
+        friend class BPlusTree;
+        friend struct InternalNode;
+        friend class NodeFactory;
+    };
+
+    struct InternalNode : Node {
+    private:
+        explicit InternalNode(size_t level) noexcept {
+            this->level_ = level;
+        }
+
+        static void move_children(InternalNode *to, size_t to_index, InternalNode *from, size_t from_index,
+                                  size_t count) noexcept {
+            std::memmove(to->children_ + to_index, from->children_ + from_index, count * sizeof(Node *));
+        }
+
+        // A leaf hands a copy of the first key of its new right half up as
+        // the separator, an internal node its middle key itself.
+        void split_child_right(size_t index, BPlusTree &tree) {
+            assert(this->key_num_ < max_keys);
+            Node *child = children_[index];
+            assert(child->key_num_ == max_keys);
+            size_t const new_keys = child->key_num_ / 2;
+
+            if (child->is_leaf_node()) {
+                Leaf *new_child = tree.nodes_.make_leaf();
+                try {
+                    this->insert_key(index, child->keys_[new_keys]);
+                } catch (...) {
+                    tree.nodes_.free(new_child);
+                    throw;
+                }
+                new_child->key_num_ = child->key_num_ - new_keys;
+                Node::relocate(new_child->keys_, child->keys_ + new_keys, new_child->key_num_);
+                child->key_num_ = new_keys;
+                tree.link_after(child->as_leaf(), new_child);
+                move_children(this, index + 2, this, index + 1, this->key_num_ - index - 1);
+                children_[index + 1] = new_child;
+                return;
+            }
+
+            InternalNode *new_child = tree.nodes_.make_internal(child->level_);
+            move_children(this, index + 2, this, index + 1, this->key_num_ - index);
+            this->open_gap(index);
+            Node::relocate(this->keys_ + index, child->keys_ + new_keys, 1);
+            children_[index + 1] = new_child;
+
+            size_t const offset = new_keys + 1;
+            new_child->key_num_ = child->key_num_ - offset;
+            Node::relocate(new_child->keys_, child->keys_ + offset, new_child->key_num_);
+            child->key_num_ = new_keys;
+            move_children(new_child, 0, child->as_internal(), offset, new_child->key_num_ + 1);
+        }
+
+        // Leaves drop the separator between them, internal nodes take it
+        // down between their keys.
+        void merge_child_with_right(size_t index, BPlusTree &tree) noexcept {
+            assert(index < this->key_num_);
+            Node *center_child = children_[index];
+            Node *right_child = children_[index + 1];
+
+            if (center_child->is_leaf_node()) {
+                assert(center_child->key_num_ + right_child->key_num_ <= max_keys);
+                center_child->as_leaf()->append(right_child->as_leaf());
+                tree.unlink(right_child->as_leaf());
+                this->remove_key(index);
+            } else {
+                size_t const right_keys = right_child->key_num_;
+                size_t const center_keys = center_child->key_num_;
+                assert(center_keys + right_keys < max_keys);
+                size_t const offset = center_keys + 1;
+                Node::relocate(center_child->keys_ + center_keys, this->keys_ + index, 1);
+                this->close_gap(index);
+                Node::relocate(center_child->keys_ + offset, right_child->keys_, right_keys);
+                move_children(center_child->as_internal(), offset, right_child->as_internal(), 0, right_keys + 1);
+                center_child->key_num_ += right_keys + 1;
+                right_child->key_num_ = 0;
+            }
+            move_children(this, index + 1, this, index + 2, this->key_num_ - index);
+            tree.nodes_.free(right_child);
+        }
+
+        // Moves the last key of the left neighbour of child index over to
+        // it. The new separator is copied before anything moves, so a
+        // throwing copy leaves the tree as it was.
+        void take_from_left(size_t index) {
+            assert(index > 0);
+            Node *center_child = children_[index];
+            Node *left_child = children_[index - 1];
+            size_t const left_keys = left_child->key_num_;
+            size_t const center_keys = center_child->key_num_;
+            assert(left_keys > min_keys && center_keys < max_keys);
+
+            if (center_child->is_leaf_node()) {
+                this->keys_[index - 1] = left_child->keys_[left_keys - 1];
+                Node::relocate(center_child->keys_ + 1, center_child->keys_, center_keys);
+                Node::relocate(center_child->keys_, left_child->keys_ + left_keys - 1, 1);
+            } else {
+                InternalNode *center = center_child->as_internal();
+                move_children(center, 1, center, 0, center_keys + 1);
+                move_children(center, 0, left_child->as_internal(), left_keys, 1);
+                Node::relocate(center_child->keys_ + 1, center_child->keys_, center_keys);
+                Node::relocate(center_child->keys_, this->keys_ + index - 1, 1);
+                Node::relocate(this->keys_ + index - 1, left_child->keys_ + left_keys - 1, 1);
+            }
+            --left_child->key_num_;
+            ++center_child->key_num_;
+        }
+
+        // The mirror image of take_from_left.
+        void take_from_right(size_t index) {
+            assert(index < this->key_num_);
+            Node *center_child = children_[index];
+            Node *right_child = children_[index + 1];
+            size_t const right_keys = right_child->key_num_;
+            size_t const center_keys = center_child->key_num_;
+            assert(right_keys > min_keys && center_keys < max_keys);
+
+            if (center_child->is_leaf_node()) {
+                this->keys_[index] = right_child->keys_[1];
+                Node::relocate(center_child->keys_ + center_keys, right_child->keys_, 1);
+            } else {
+                Node::relocate(center_child->keys_ + center_keys, this->keys_ + index, 1);
+                Node::relocate(this->keys_ + index, right_child->keys_, 1);
+                InternalNode *right = right_child->as_internal();
+                move_children(center_child->as_internal(), center_keys + 1, right, 0, 1);
+                move_children(right, 0, right, 1, right_keys);
+            }
+            Node::relocate(right_child->keys_, right_child->keys_ + 1, right_keys - 1);
+            ++center_child->key_num_;
+            --right_child->key_num_;
+        }
+
+        // Borrows a key for the underfull child index from a neighbour
+        // that can spare one, or merges it with a neighbour.
+        void fix_child(size_t index, BPlusTree &tree) {
+            assert(children_[index]->key_num_ < min_keys);
+            if (index != 0 && children_[index - 1]->key_num_ > min_keys) {
+                take_from_left(index);
+            } else if (index != this->key_num_ && children_[index + 1]->key_num_ > min_keys) {
+                take_from_right(index);
+            } else {
+                merge_child_with_right(std::min(index, this->key_num_ - 1), tree);
+            }
+        }
+
+        Node *children_[max_children]{};
+
+        friend class BPlusTree;
+        friend struct Node;
+        friend class NodeFactory;
+    };
+
+    // Makes and frees nodes through Allocator rebound to each node layout.
+    class NodeFactory {
+        using leaf_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Leaf>;
+        using leaf_traits = std::allocator_traits<leaf_allocator>;
+        using internal_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<InternalNode>;
+        using internal_traits = std::allocator_traits<internal_allocator>;
+
+    public:
+        NodeFactory() = default;
+
+        explicit NodeFactory(Allocator const &allocator) : allocator_(allocator) {}
+
+        [[nodiscard]] Allocator get_allocator() const {
+            return Allocator(allocator_);
+        }
+
+        [[nodiscard]] Leaf *make_leaf() {
+            Leaf *node = std::to_address(leaf_traits::allocate(allocator_, 1));
+            return ::new(static_cast<void *>(node)) Leaf();
+        }
+
+        [[nodiscard]] InternalNode *make_internal(size_t level) {
+            internal_allocator allocator(allocator_);
+            InternalNode *node = std::to_address(internal_traits::allocate(allocator, 1));
+            return ::new(static_cast<void *>(node)) InternalNode(level);
+        }
+
+        // Frees a single node, but not its children.
+        void free(Node *node) noexcept {
+            if (node->is_leaf_node()) {
+                Leaf *leaf = node->as_leaf();
+                leaf->~Leaf();
+                leaf_traits::deallocate(allocator_, leaf, 1);
+            } else {
+                InternalNode *internal = node->as_internal();
+                internal->~InternalNode();
+                internal_allocator allocator(allocator_);
+                internal_traits::deallocate(allocator, internal, 1);
+            }
+        }
+
+        // Frees the node along with its subtree.
+        void destroy(Node *node) noexcept {
+            if (node->is_internal_node()) {
+                for (size_t i = 0; i <= node->key_num_; ++i) {
+                    destroy(node->child(i));
+                }
+            }
+            free(node);
+        }
+
+        // Copies the subtree, linking its leaves after last, which ends up
+        // being the last leaf of the copy. Frees what it copied if it throws.
+        [[nodiscard]] Node *clone(Node const *node, Leaf *&last) {
+            if (node->is_leaf_node()) {
+                Leaf *copy = make_leaf();
+                try {
+                    copy->copy_keys(node);
+                } catch (...) {
+                    free(copy);
+                    throw;
+                }
+                copy->prev_ = last;
+                if (last != nullptr) last->next_ = copy;
+                last = copy;
+                return copy;
+            }
+            InternalNode *copy = make_internal(node->level_);
+            size_t i = 0;
+            try {
+                copy->copy_keys(node);
+                for (; i <= node->key_num_; ++i) {
+                    copy->children_[i] = clone(node->child(i), last);
+                }
+            } catch (...) {
+                while (i-- > 0) {
+                    destroy(copy->children_[i]);
+                }
+                free(copy);
+                throw;
+            }
+            return copy;
+        }
+
+    private:
+        [[no_unique_address]] leaf_allocator allocator_;
+    };
+
+public:
+    // A position in the leaf list, the end being past the last leaf.
+    struct const_iterator {
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = T const;
+        using pointer = value_type *;
+        using reference = value_type &;
+
+        const_iterator() noexcept = default;
+
+        const_iterator &operator--() noexcept {
+            if (leaf_ == nullptr) {
+                leaf_ = tree_->last_;
+                index_ = leaf_->key_num_;
+            } else if (index_ == 0) {
+                leaf_ = leaf_->prev_;
+                index_ = leaf_->key_num_;
+            }
+            --index_;
+            return *this;
+        }
+
+        const_iterator operator--(int) noexcept {
+            const_iterator temp{*this};
+            --(*this);
+            return temp;
+        }
+
+        const_iterator &operator++() noexcept {
+            if (++index_ == leaf_->key_num_) {
+                leaf_ = leaf_->next_;
+                index_ = 0;
+            }
+            return *this;
+        }
+
+        const_iterator operator++(int) noexcept {
+            const_iterator temp{*this};
+            ++(*this);
+            return temp;
+        }
+
+        reference operator*() const noexcept {
+            return leaf_->keys_[index_];
+        }
+
+        pointer operator->() const noexcept {
+            return leaf_->keys_ + index_;
+        }
+
+        friend bool operator==(const const_iterator &a, const const_iterator &b) noexcept {
+            assert(a.tree_ == b.tree_);
+            return a.leaf_ == b.leaf_ && a.index_ == b.index_;
+        }
+
+        friend bool operator!=(const const_iterator &a, const const_iterator &b) noexcept {
+            return !(a == b);
+        }
+
+        friend bool operator==(const const_iterator &it, std::default_sentinel_t) noexcept {
+            return it.leaf_ == nullptr;
+        }
+
+    private:
+        // Past the end of a leaf means the start of the next one.
+        const_iterator(BPlusTree const &tree, Leaf *leaf, size_t index) noexcept
+                : tree_(&tree), leaf_(leaf), index_(index) {
+            if (leaf_ != nullptr && index_ == leaf_->key_num_) {
+                leaf_ = leaf_->next_;
+                index_ = 0;
+            }
+        }
+
+        BPlusTree const *tree_ = nullptr;
+        Leaf *leaf_ = nullptr;
+        size_t index_ = 0;
+
+        friend class BPlusTree;
+    };
+
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    // Keys cannot be changed in place, so iterators are all const.
+    using iterator = const_iterator;
+    using reverse_iterator = const_reverse_iterator;
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using allocator_type = Allocator;
+
+    BPlusTree() = default;
+
+    explicit BPlusTree(Comparator comparator, Allocator const &allocator = Allocator())
+            : nodes_(allocator), comparator_(comparator) {}
+
+    explicit BPlusTree(Allocator const &allocator) : nodes_(allocator) {}
+
+    BPlusTree(BPlusTree const &other)
+            : nodes_(std::allocator_traits<Allocator>::select_on_container_copy_construction(other.get_allocator())),
+              comparator_(other.comparator_) {
+        if (other.root_ == nullptr) return;
+        root_ = nodes_.clone(other.root_, last_);
+        first_ = leftmost_leaf(root_);
+        size_ = other.size_;
+    }
+
+    BPlusTree &operator=(BPlusTree const &other) {
+        if (this != &other) {
+            BPlusTree(other).swap(*this);
+        }
+        return *this;
+    }
+
+    BPlusTree(BPlusTree &&other) noexcept
+            : root_(std::exchange(other.root_, nullptr)), first_(std::exchange(other.first_, nullptr)),
+              last_(std::exchange(other.last_, nullptr)), size_(std::exchange(other.size_, 0)),
+              nodes_(other.nodes_), comparator_(other.comparator_) {}
+
+    BPlusTree &operator=(BPlusTree &&other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    void swap(BPlusTree &other) noexcept {
+        std::swap(root_, other.root_);
+        std::swap(first_, other.first_);
+        std::swap(last_, other.last_);
+        std::swap(size_, other.size_);
+        std::swap(comparator_, other.comparator_);
+        if constexpr (std::allocator_traits<Allocator>::propagate_on_container_swap::value) {
+            std::swap(nodes_, other.nodes_);
+        }
+    }
+
+    [[nodiscard]] Allocator get_allocator() const {
+        return nodes_.get_allocator();
+    }
+
+    [[nodiscard]] bool empty() const {
+        return root_ == nullptr;
+    }
+
+    [[nodiscard]] size_t size() const noexcept {
+        return size_;
+    }
+
+    const_iterator find(T const &value) const {
+        return find<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    const_iterator find(K const &value) const {
+        const_iterator it = lower_bound(value);
+        if (it != end() && comparator_(value, *it)) return end();
+        return it;
+    }
+
+    const_iterator lower_bound(T const &value) const {
+        return lower_bound<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    const_iterator lower_bound(K const &value) const {
+        if (root_ == nullptr) return end();
+        Node *node = root_;
+        while (node->is_internal_node()) {
+            node = node->child(find_index(node, value));
+        }
+        return const_iterator(*this, node->as_leaf(), find_index(node, value));
+    }
+
+    const_iterator upper_bound(T const &value) const {
+        return upper_bound<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    const_iterator upper_bound(K const &value) const {
+        if (root_ == nullptr) return end();
+        Node *node = root_;
+        while (node->is_internal_node()) {
+            node = node->child(find_upper_index(node, value));
+        }
+        return const_iterator(*this, node->as_leaf(), find_upper_index(node, value));
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(T const &value) const {
+        return equal_range<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    std::pair<const_iterator, const_iterator> equal_range(K const &value) const {
+        return {lower_bound(value), upper_bound(value)};
+    }
+
+    bool contains(T const &value) const {
+        return contains<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    bool contains(K const &value) const {
+        return find(value) != end();
+    }
+
+    // Goes after the keys equal to value.
+    void insert(T const &value) {
+        if (root_ == nullptr) {
+            Leaf *leaf = nodes_.make_leaf();
+            try {
+                leaf->insert_key(0, value);
+            } catch (...) {
+                nodes_.free(leaf);
+                throw;
+            }
+            root_ = first_ = last_ = leaf;
+            size_ = 1;
+            return;
+        }
+
+        if (root_->is_full()) {
+            InternalNode *new_root = nodes_.make_internal(root_->level_ + 1);
+            new_root->children_[0] = root_;
+            try {
+                new_root->split_child_right(0, *this);
+            } catch (...) {
+                nodes_.free(new_root);
+                throw;
+            }
+            root_ = new_root;
+        }
+
+        Node *node = root_;
+        while (node->is_internal_node()) {
+            InternalNode *internal = node->as_internal();
+            size_t index = find_upper_index(node, value);
+            if (internal->children_[index]->is_full()) {
+                internal->split_child_right(index, *this);
+                if (!comparator_(value, node->keys_[index])) ++index;
+            }
+            node = internal->children_[index];
+        }
+        node->insert_key(find_upper_index(node, value), value);
+        ++size_;
+    }
+
+    // Removes one occurrence of value, returns whether there was one.
+    // Separators are left alone, they still separate the same children
+    // when the key they were copied from is gone. Underfull nodes are
+    // fixed on the way back up.
+    bool remove(T const &value) {
+        return remove<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    bool remove(K const &value) {
+        if (root_ == nullptr) return false;
+
+        struct Step {
+            InternalNode *node;
+            size_t index;
+        };
+        Step path[max_height];
+        size_t depth = 0;
+        Node *node = root_;
+        while (node->is_internal_node()) {
+            size_t const index = find_index(node, value);
+            path[depth++] = {node->as_internal(), index};
+            node = node->child(index);
+        }
+
+        size_t index = find_index(node, value);
+        if (index == node->key_num_) {
+            // The first equal key may start the next leaf, which is the
+            // leftmost one under the next child of the lowest ancestor that
+            // has one.
+            Leaf *next = node->as_leaf()->next_;
+            if (next == nullptr || comparator_(value, next->keys_[0])) return false;
+            while (path[depth - 1].index == path[depth - 1].node->key_num_) {
+                --depth;
+            }
+            node = path[depth - 1].node->child(++path[depth - 1].index);
+            while (node->is_internal_node()) {
+                path[depth++] = {node->as_internal(), 0};
+                node = node->child(0);
+            }
+            index = 0;
+        }
+        if (comparator_(value, node->keys_[index])) return false;
+
+        node->remove_key(index);
+        --size_;
+        while (depth != 0 && node->key_num_ < min_keys) {
+            Step const step = path[--depth];
+            step.node->fix_child(step.index, *this);
+            node = step.node;
+        }
+        if (root_->key_num_ == 0) {
+            Node *old_root = root_;
+            if (old_root->is_leaf_node()) {
+                root_ = first_ = last_ = nullptr;
+            } else {
+                root_ = old_root->child(0);
+            }
+            nodes_.free(old_root);
+        }
+        return true;
+    }
+
+    void clear() {
+        if (root_ == nullptr) return;
+        nodes_.destroy(root_);
+        root_ = first_ = last_ = nullptr;
+        size_ = 0;
+    }
+
+    const_iterator begin() const { return const_iterator(*this, first_, 0); }
+
+    const_iterator end() const { return const_iterator(*this, nullptr, 0); }
+
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    ~BPlusTree() {
+        clear();
+    }
+
+private:
+    Node *root_ = nullptr;
+    Leaf *first_ = nullptr;
+    Leaf *last_ = nullptr;
+    size_t size_ = 0;
+    NodeFactory nodes_{};
+    Comparator comparator_{};
+
+    static Leaf *leftmost_leaf(Node *node) noexcept {
+        while (node->is_internal_node()) {
+            node = node->child(0);
+        }
+        return node->as_leaf();
+    }
+
+    void link_after(Leaf *leaf, Leaf *new_leaf) noexcept {
+        new_leaf->prev_ = leaf;
+        new_leaf->next_ = leaf->next_;
+        if (leaf->next_ != nullptr) leaf->next_->prev_ = new_leaf;
+        else last_ = new_leaf;
+        leaf->next_ = new_leaf;
+    }
+
+    // Never the first leaf, merges keep the left one.
+    void unlink(Leaf *leaf) noexcept {
+        assert(leaf->prev_ != nullptr);
+        leaf->prev_->next_ = leaf->next_;
+        if (leaf->next_ != nullptr) leaf->next_->prev_ = leaf->prev_;
+        else last_ = leaf->prev_;
+    }
+
+    // The first key not less than value.
+    template<typename K>
+    size_t find_index(Node const *node, K const &value) const {
+#ifdef B_TREE_AVX2_SEARCH
+        if constexpr (std::same_as<K, T> && detail::vector_searchable<T, Comparator>) {
+            if (detail::cpu_has_avx2) return detail::vector_search<false>(node->keys_, node->key_num_, value);
+        }
+#endif
+        T const *left = node->keys_;
+        T const *right = left + node->key_num_;
+        while (right != left) {
+            T const *mid = left + (right - left) / 2;
+            if (comparator_(*mid, value)) left = mid + 1;
+            else right = mid;
+        }
+        return left - node->keys_;
+    }
+
+    // The first key greater than value.
+    template<typename K>
+    size_t find_upper_index(Node const *node, K const &value) const {
+#ifdef B_TREE_AVX2_SEARCH
+        if constexpr (std::same_as<K, T> && detail::vector_searchable<T, Comparator>) {
+            if (detail::cpu_has_avx2) return detail::vector_search<true>(node->keys_, node->key_num_, value);
+        }
+#endif
+        T const *left = node->keys_;
+        T const *right = left + node->key_num_;
+        while (right != left) {
+            T const *mid = left + (right - left) / 2;
+            if (comparator_(value, *mid)) right = mid;
+            else left = mid + 1;
+        }
+        return left - node->keys_;
+    }
+};
+
+}  // namespace b_tree
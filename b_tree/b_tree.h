@@ -1,314 +1,599 @@
+#pragma once
+
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <compare>
 #include <concepts>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <initializer_list>
+#include <iterator>
 #include <memory>
-#include <stack>
+#include <new>
+#include <numeric>
+#include <optional>
+#include <ranges>
+#include <stdexcept>
 #include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "key_search.h"
+#include "node_keys.h"
+#include "parallel.h"
+
 namespace b_tree {
 
-template<std::copyable T, size_t Order, typename Comparator = std::less<>>
+// Tells a constructor that its input is already sorted.
+struct from_sorted_t {
+    explicit from_sorted_t() = default;
+};
+
+inline constexpr from_sorted_t from_sorted{};
+
+// Optional bookkeeping and node layout, picked with the Policy parameter of
+// BTree. Policies derive from default_policy and override what they change.
+struct default_policy {
+    // Keep the number of keys under each child in internal nodes, which
+    // gives rank, nth and count_range in O(log N) at the cost of a word
+    // per child and an extra lookup per remove.
+    static constexpr bool subtree_counts = false;
+    // Over-align nodes to this, 0 leaves them at their natural alignment.
+    static constexpr size_t node_alignment = 0;
+    // Prefetch all the cache lines holding a node's keys before searching
+    // it, so that the searches of large nodes miss the cache about once
+    // instead of once per probe. Trees with fewer than prefetch_min_bytes
+    // of keys mostly stay in the cache, where prefetching only costs, so
+    // they skip it, and so do nodes whose keys fit into a cache line.
+    static constexpr bool prefetch_keys = false;
+    static constexpr size_t prefetch_min_bytes = size_t(2) << 20;
+    // Share nodes between copies of a tree instead of copying them, so a
+    // copy takes O(1), and copy the nodes a change goes through only once
+    // it comes to them. The nodes are reference counted for it, and keys
+    // must be copyable. Copies share the allocator too, and may be read
+    // or destroyed on other threads as long as the allocator is fine with
+    // that (std::allocator is, PoolAllocator is not).
+    static constexpr bool copy_on_write = false;
+};
+
+struct order_statistics_policy : default_policy {
+    static constexpr bool subtree_counts = true;
+};
+
+// For large Orders and trees that do not fit into the cache: nodes start on
+// a cache line and are fetched whole once the tree outgrows
+// prefetch_min_bytes.
+struct cache_line_policy : default_policy {
+    static constexpr size_t node_alignment = 64;
+    static constexpr bool prefetch_keys = true;
+};
+
+// For handing snapshots of a changing tree to readers.
+struct copy_on_write_policy : default_policy {
+    static constexpr bool copy_on_write = true;
+};
+
+template<std::movable T, size_t Order, typename Comparator = std::less<>, typename Allocator = std::allocator<T>,
+        typename Policy = default_policy>
 class BTree {
     static_assert(Order > 1, "Order must be greater than 1");
 
-    static const size_t max_children = Order * 2;
-    static const size_t max_keys = max_children - 1;
-    static const size_t min_children = Order;
-    static const size_t min_keys = min_children - 1;
+    static constexpr size_t max_children = Order * 2;
+    static constexpr size_t max_keys = max_children - 1;
+    static constexpr size_t min_children = Order;
+    static constexpr size_t min_keys = min_children - 1;
 
     static_assert(min_children < max_children);
     static_assert(min_keys < max_keys);
     // Deletion uses this.
     static_assert(min_keys * 2 + 1 == max_keys);
-    // Allows not to explicitly null children pointers when deleting
-    // or splitting. To tell a node not to delete its child pointers,
-    // setting its number of keys to 0 is needed. This doesn't allow
-    // for an order 1 tree (effectively a binary tree), but using a
-    // B-tree of such order would not be sensible anyway.
+    // This doesn't allow for an order 1 tree (effectively a binary
+    // tree), but using a B-tree of such order would not be sensible anyway.
     static_assert(min_keys != 0);
 
-    struct Node {
+    // No tree that fits into memory is higher: every level below the root
+    // has at least min_children times as many nodes as the one above.
+    static constexpr size_t max_height = [] {
+        size_t height = 2;
+        for (size_t nodes = 2; nodes < SIZE_MAX / min_children; nodes *= min_children) {
+            ++height;
+        }
+        return height;
+    }();
+
+    static constexpr bool counted = Policy::subtree_counts;
+    static constexpr bool copy_on_write = Policy::copy_on_write;
+    static_assert(!copy_on_write || std::copyable<T>, "Copy-on-write trees copy their keys");
+    // Comparator may also be a three-way comparison like
+    // std::compare_three_way. Plain std::less on keys with <=> gets
+    // compared three-way too where that tells equal keys apart for free.
+    static constexpr bool three_way_comparator = requires(Comparator const &comparator, T const &key) {
+        { comparator(key, key) } -> std::convertible_to<std::partial_ordering>;
+    };
+    template<typename K>
+    static constexpr bool three_way_with = three_way_comparator
+            || (std::same_as<Comparator, std::less<>> || std::same_as<Comparator, std::less<T>>)
+               && std::three_way_comparable_with<T, K>;
+    static constexpr bool three_way = three_way_with<T>;
+    // Lookups take anything a transparent Comparator, like the default
+    // std::less<>, compares with keys, so that e.g. a std::string_view
+    // finds std::string keys without making a std::string first.
+    template<typename K>
+    static constexpr bool lookup_key = std::same_as<K, T> || requires { typename Comparator::is_transparent; };
+    // The parallel operations have their threads share the allocator,
+    // which only allocators that are always equal, like std::allocator,
+    // are trusted with. Trees with other allocators, and trees too small
+    // to be worth starting threads for, do them on the calling thread.
+    static constexpr bool parallel_allocator = std::allocator_traits<Allocator>::is_always_equal::value;
+    static constexpr size_t min_parallel_size = 1 << 14;
+    static constexpr size_t node_alignment = std::max(Policy::node_alignment, alignof(detail::NodeKeys<T, max_keys>));
+
+    struct Empty {};
+
+    struct InternalNode;
+    class NodeFactory;
+
+    // Leaves are bare Nodes, only internal nodes carry children. A node's
+    // level is its height above the leaves, which is all it takes to tell
+    // the layouts apart without touching the children.
+    struct alignas(node_alignment) Node : detail::NodeKeys<T, max_keys> {
     private:
-        Node() noexcept: keys_(new T[max_keys]), key_num_() {}
+        Node() noexcept = default;  // a leaf
 
-        explicit Node(T first_value) noexcept: Node() {  // initial root creation
-            keys_[0] = first_value;
-            ++key_num_;
+        [[nodiscard]] InternalNode *as_internal() noexcept {
+            assert(this->is_internal_node());
+            return static_cast<InternalNode *>(this);
         }
 
-        explicit Node(Node *first_child) : Node() {  // new root creation
-            assert(first_child != nullptr);
-            children_[0] = first_child;
-            split_child_right(0);
+        [[nodiscard]] InternalNode const *as_internal() const noexcept {
+            assert(this->is_internal_node());
+            return static_cast<InternalNode const *>(this);
         }
 
-        [[nodiscard]] bool is_full() const noexcept {
-            return key_num_ == max_keys;
+        [[nodiscard]] Node *child(size_t index) const noexcept {
+            return as_internal()->children_[index];
         }
 
-        [[nodiscard]] bool is_leaf_node() const noexcept {
-            return children_[0] == nullptr;
-        };
+        // Like child(), but runs out at the leaves.
+        [[nodiscard]] Node *child_below(size_t index) const noexcept {
+            return this->is_leaf_node() ? nullptr : child(index);
+        }
 
-        [[nodiscard]] bool is_internal_node() const noexcept {
-            return children_[0] != nullptr;
-        };
+        void remove_leaf(size_t index) noexcept {
+            assert(this->is_leaf_node());
+            //assert(key_num_ > min_keys); may not hold for root
+            this->remove_key(index);
+        }
 
-        void split_child_right(size_t index) {
-            assert(key_num_ < max_keys);
-            assert(is_internal_node());
-            Node *child = children_[index];
-            assert(child->key_num_ == max_keys);
-            Node *new_child = new Node();
+        [[nodiscard]] bool is_shared() const noexcept {
+            if constexpr (copy_on_write) return shares_.load(std::memory_order_acquire) != 0;
+            else return false;
+        }
 
-            const size_t new_keys = child->key_num_ / 2;
-            for (size_t i = key_num_; i > index; --i) {
-                children_[i + 1] = children_[i];
+        // With copy_on_write, how many more parents and roots than one
+        // the node has, in this tree and its copies.
+        [[no_unique_address]] std::conditional_t<copy_on_write, std::atomic<size_t>, Empty> shares_{};
+
+        friend class BTree;
+        friend struct InternalNode;
+        friend class NodeFactory;
+    };
+
+    struct InternalNode : Node {
+    private:
+        explicit InternalNode(size_t level) noexcept {
+            this->level_ = level;
+        }
+
+        // The number of keys in the subtree of a node, which takes adding
+        // up the counts of its children.
+        [[nodiscard]] static size_t subtree_size(Node const *node) noexcept requires counted {
+            if (node->is_leaf_node()) return node->key_num_;
+            InternalNode const *internal = node->as_internal();
+            size_t size = node->key_num_;
+            for (size_t i = 0; i <= node->key_num_; ++i) {
+                size += internal->counts_[i];
             }
-            for (size_t i = key_num_; i > index; --i) {
-                keys_[i] = keys_[i - 1];
+            return size;
+        }
+
+        // The child at index, made this tree's own first if it is shared,
+        // for changing it.
+        Node *own_child(size_t index, NodeFactory &nodes) noexcept(!copy_on_write) {
+            if constexpr (copy_on_write) children_[index] = nodes.own(children_[index]);
+            return children_[index];
+        }
+
+        void set_child(size_t index, Node *child, [[maybe_unused]] size_t size) noexcept {
+            children_[index] = child;
+            if constexpr (counted) counts_[index] = size;
+        }
+
+        // Moves count children (with their counts) from index from_index of
+        // from to to_index of to. The ranges may overlap.
+        static void move_children(InternalNode *to, size_t to_index, InternalNode *from, size_t from_index,
+                                  size_t count) noexcept {
+            std::memmove(to->children_ + to_index, from->children_ + from_index, count * sizeof(Node *));
+            if constexpr (counted) {
+                std::memmove(to->counts_.data() + to_index, from->counts_.data() + from_index,
+                             count * sizeof(size_t));
             }
-            keys_[index] = child->keys_[new_keys];
-            ++key_num_;
+        }
+
+        // The total count of children [first, first + count) of node, 0
+        // for leaves.
+        [[nodiscard]] static size_t count_children(Node const *node, size_t first, size_t count) noexcept
+        requires counted {
+            if (node->is_leaf_node()) return 0;
+            auto const &counts = node->as_internal()->counts_;
+            return std::accumulate(counts.begin() + first, counts.begin() + first + count, size_t());
+        }
+
+        void split_child_right(size_t index, NodeFactory &nodes) {
+            assert(this->key_num_ < max_keys);
+            Node *child = own_child(index, nodes);
+            assert(child->key_num_ == max_keys);
+            Node *new_child = nodes.make_sibling(child);
+
+            const size_t new_keys = child->key_num_ / 2;
+            move_children(this, index + 2, this, index + 1, this->key_num_ - index);
+            this->open_gap(index);
+            Node::relocate(this->keys_ + index, child->keys_ + new_keys, 1);
             children_[index + 1] = new_child;
 
             const size_t offset = new_keys + 1;
             new_child->key_num_ = child->key_num_ - offset;
-            for (size_t i = 0; i < new_child->key_num_; i++) {
-                new_child->keys_[i] = child->keys_[i + offset];
-            }
+            Node::relocate(new_child->keys_, child->keys_ + offset, new_child->key_num_);
             child->key_num_ = new_keys;
             if (child->is_internal_node()) {
-                for (size_t i = 0; i <= new_child->key_num_; i++) {
-                    new_child->children_[i] = child->children_[i + offset];
-                }
+                move_children(new_child->as_internal(), 0, child->as_internal(), offset, new_child->key_num_ + 1);
             }
-        }
-
-        void remove_leaf(size_t index) noexcept {
-            assert(is_leaf_node());
-            //assert(key_num_ > min_keys); may not hold for root
-            for (size_t i = index + 1; i < key_num_; ++i) {
-                keys_[i - 1] = keys_[i];
+            if constexpr (counted) {
+                counts_[index + 1] = subtree_size(new_child);
+                counts_[index] -= counts_[index + 1] + 1;
             }
-            --key_num_;
         }
 
-        void ensure_child_full(size_t index) noexcept {
-            assert(index >= 0 && index <= key_num_);
-            if (children_[index]->key_num_ > min_keys) return;
+        // Leaves the child at index this tree's own, for the caller to go
+        // down to.
+        void ensure_child_full(size_t index, NodeFactory &nodes) noexcept(!copy_on_write) {
+            size_t const key_num = this->key_num_;
+            assert(index >= 0 && index <= key_num);
+            if (own_child(index, nodes)->key_num_ > min_keys) return;
             assert(children_[index]->key_num_ == min_keys);
             if (index != 0 && children_[index - 1]->key_num_ > min_keys) {
-                take_from_left(index);
-            } else if (index != key_num_ && children_[index + 1]->key_num_ > min_keys) {
-                take_from_right(index);
+                take_from_left(index, nodes);
+            } else if (index != key_num && children_[index + 1]->key_num_ > min_keys) {
+                take_from_right(index, nodes);
             } else {
                 assert(index == 0
                        ? children_[1]->key_num_ == min_keys
-                       : (index == key_num_ ? children_[key_num_ - 1]->key_num_ == min_keys
-                                            : children_[index - 1]->key_num_ == min_keys
-                                              && children_[index + 1]->key_num_ == min_keys));
-                merge_child_with_right(std::min(index, key_num_ - 1));
+                       : (index == key_num ? children_[key_num - 1]->key_num_ == min_keys
+                                           : children_[index - 1]->key_num_ == min_keys
+                                             && children_[index + 1]->key_num_ == min_keys));
+                merge_child_with_right(std::min(index, key_num - 1), nodes);
             }
         }
 
-        void merge_child_with_right(size_t index) noexcept {
+        void merge_child_with_right(size_t index, NodeFactory &nodes) noexcept(!copy_on_write) {
             //assert(key_num_ > min_keys); // may not hold for root
-            assert(index + 1 <= key_num_);
-            assert(is_internal_node());
-            Node *center_child = children_[index];
-            Node *right_child = children_[index + 1];
+            assert(index + 1 <= this->key_num_);
+            Node *center_child = own_child(index, nodes);
+            Node *right_child = own_child(index + 1, nodes);
             size_t const right_keys = right_child->key_num_;
             size_t const center_keys = center_child->key_num_;
-            assert(right_keys == min_keys);
-            assert(center_keys == min_keys);
+            assert(center_keys + right_keys < max_keys);
             size_t const offset = center_keys + 1;
 
-            center_child->keys_[center_keys] = keys_[index];
-            for (size_t i = index + 1; i < key_num_; ++i) {
-                keys_[i - 1] = keys_[i];
-                children_[i] = children_[i + 1];
-            }
-            --key_num_;
+            if constexpr (counted) counts_[index] += counts_[index + 1] + 1;
+            Node::relocate(center_child->keys_ + center_keys, this->keys_ + index, 1);
+            move_children(this, index + 1, this, index + 2, this->key_num_ - index - 1);
+            this->close_gap(index);
 
-            for (size_t i = 0; i < right_keys; ++i) {
-                center_child->keys_[i + offset] = right_child->keys_[i];
-            }
+            Node::relocate(center_child->keys_ + offset, right_child->keys_, right_keys);
             if (center_child->is_internal_node()) {
-                for (size_t i = 0; i <= right_keys; ++i) {
-                    center_child->children_[i + offset] = right_child->children_[i];
-                }
+                move_children(center_child->as_internal(), offset, right_child->as_internal(), 0, right_keys + 1);
             }
 
             center_child->key_num_ += right_keys + 1;
-            assert(center_child->key_num_ == max_keys);
             right_child->key_num_ = 0;
-            delete right_child;
+            nodes.free(right_child);
         }
 
-        ~Node() {
-            delete[] keys_;
-            if (key_num_ == 0) return; // only possible when deleting an old root or merging
-            for (size_t i = 0; i <= key_num_; ++i) {
-                delete children_[i];
+        // Rotates count keys from the left neighbour of child index through
+        // the separator between them, along with the children in between.
+        void take_from_left(size_t index, NodeFactory &nodes, size_t count = 1) noexcept(!copy_on_write) {
+            assert(index > 0);
+            Node *center_child = own_child(index, nodes);
+            Node *left_child = own_child(index - 1, nodes);
+            size_t const left_keys = left_child->key_num_;
+            size_t const center_keys = center_child->key_num_;
+            assert(count != 0 && count <= left_keys && center_keys + count <= max_keys);
+
+            if constexpr (counted) {
+                size_t const moved = count + count_children(left_child, left_keys - count + 1, count);
+                counts_[index - 1] -= moved;
+                counts_[index] += moved;
+            }
+            if (center_child->is_internal_node()) {
+                InternalNode *center = center_child->as_internal();
+                move_children(center, count, center, 0, center_keys + 1);
+                move_children(center, 0, left_child->as_internal(), left_keys - count + 1, count);
             }
+            Node::relocate(center_child->keys_ + count, center_child->keys_, center_keys);
+            Node::relocate(center_child->keys_ + count - 1, this->keys_ + index - 1, 1);
+            Node::relocate(center_child->keys_, left_child->keys_ + left_keys - count + 1, count - 1);
+            Node::relocate(this->keys_ + index - 1, left_child->keys_ + left_keys - count, 1);
+            left_child->key_num_ -= count;
+            center_child->key_num_ += count;
         }
 
-        Node *clone() const {
-            assert(key_num_ != 0);
-            auto node = new Node();
-            for (size_t i = 0; i < key_num_; ++i) {
-                node->keys_[i] = keys_[i];
+        // The mirror image of take_from_left.
+        void take_from_right(size_t index, NodeFactory &nodes, size_t count = 1) noexcept(!copy_on_write) {
+            assert(index + 1 <= this->key_num_);
+            Node *center_child = own_child(index, nodes);
+            Node *right_child = own_child(index + 1, nodes);
+            size_t const right_keys = right_child->key_num_;
+            size_t const center_keys = center_child->key_num_;
+            assert(count != 0 && count <= right_keys && center_keys + count <= max_keys);
+
+            if constexpr (counted) {
+                size_t const moved = count + count_children(right_child, 0, count);
+                counts_[index + 1] -= moved;
+                counts_[index] += moved;
             }
-            node->key_num_ = key_num_;
-            if (is_leaf_node()) return node;
-            for (size_t i = 0; i <= key_num_; ++i) {
-                node->children_[i] = children_[i]->clone();
+            Node::relocate(center_child->keys_ + center_keys, this->keys_ + index, 1);
+            Node::relocate(center_child->keys_ + center_keys + 1, right_child->keys_, count - 1);
+            Node::relocate(this->keys_ + index, right_child->keys_ + count - 1, 1);
+            Node::relocate(right_child->keys_, right_child->keys_ + count, right_keys - count);
+
+            if (right_child->is_internal_node()) {
+                InternalNode *right = right_child->as_internal();
+                move_children(center_child->as_internal(), center_keys + 1, right, 0, count);
+                move_children(right, 0, right, count, right_keys + 1 - count);
             }
-            return node;
-        };
+            center_child->key_num_ += count;
+            right_child->key_num_ -= count;
+        }
 
-        void take_from_left(size_t index) noexcept {
-            assert(index > 0);
-            Node *center_child = children_[index];
-            Node *left_child = children_[index - 1];
-            assert(left_child->key_num_ > min_keys);
-            assert(center_child->key_num_ == min_keys);
+        Node *children_[max_children]{};
+        // With subtree counts, the number of keys under each child.
+        [[no_unique_address]] std::conditional_t<counted, std::array<size_t, max_children>, Empty> counts_{};
+
+        friend class BTree;
+        friend struct Node;
+        friend class NodeFactory;
+    };
+
+    // Makes and frees nodes through Allocator rebound to each node layout.
+    class NodeFactory {
+        using leaf_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+        using leaf_traits = std::allocator_traits<leaf_allocator>;
+        using internal_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<InternalNode>;
+        using internal_traits = std::allocator_traits<internal_allocator>;
+
+    public:
+        NodeFactory() = default;
+
+        explicit NodeFactory(Allocator const &allocator) : allocator_(allocator) {}
+
+        [[nodiscard]] Allocator get_allocator() const {
+            return Allocator(allocator_);
+        }
+
+        [[nodiscard]] Node *make_leaf() {
+            Node *node = std::to_address(leaf_traits::allocate(allocator_, 1));
+            return ::new(static_cast<void *>(node)) Node();
+        }
+
+        [[nodiscard]] InternalNode *make_internal(size_t level) {
+            internal_allocator allocator(allocator_);
+            InternalNode *node = std::to_address(internal_traits::allocate(allocator, 1));
+            return ::new(static_cast<void *>(node)) InternalNode(level);
+        }
+
+        [[nodiscard]] Node *make_sibling(Node const *node) {
+            if (node->is_leaf_node()) return make_leaf();
+            return make_internal(node->level_);
+        }
 
-            for (size_t i = center_child->key_num_; i > 0; --i) {
-                center_child->keys_[i] = center_child->keys_[i - 1];
+        // Frees a single node, but not its children.
+        void free(Node *node) noexcept {
+            if (node->is_leaf_node()) {
+                node->~Node();
+                leaf_traits::deallocate(allocator_, node, 1);
+            } else {
+                InternalNode *internal = node->as_internal();
+                internal->~InternalNode();
+                internal_allocator allocator(allocator_);
+                internal_traits::deallocate(allocator, internal, 1);
             }
-            center_child->keys_[0] = keys_[index - 1];
-            if (center_child->is_internal_node()) {
-                for (size_t i = center_child->key_num_ + 1; i > 0; --i) {
-                    center_child->children_[i] = center_child->children_[i - 1];
+        }
+
+        // Drops a reference to the node, and frees it along with its
+        // subtree if that was the last one.
+        void destroy(Node *node) noexcept {
+            if constexpr (copy_on_write) {
+                // The last one to let go of the node frees it.
+                if (node->is_shared() && node->shares_.fetch_sub(1, std::memory_order_acq_rel) != 0) return;
+            }
+            if (node->is_internal_node()) {
+                for (size_t i = 0; i <= node->key_num_; ++i) {
+                    destroy(node->child(i));
                 }
-                center_child->children_[0] = left_child->children_[left_child->key_num_];
             }
-            ++center_child->key_num_;
-
-            --left_child->key_num_;
-            keys_[index - 1] = left_child->keys_[left_child->key_num_];
+            free(node);
         }
 
-        void take_from_right(size_t index) noexcept {
-            assert(index + 1 <= key_num_);
-            Node *center_child = children_[index];
-            Node *right_child = children_[index + 1];
-            assert(right_child->key_num_ > min_keys);
-            assert(center_child->key_num_ == min_keys);
-
-            center_child->keys_[center_child->key_num_] = keys_[index];
-            ++center_child->key_num_;
-            keys_[index] = right_child->keys_[0];
+        // Frees every node at once, if the allocator can do that. Skipping
+        // the destructors is only fine for trivially destructible keys, and
+        // the nodes must not be shared with other trees.
+        bool release() noexcept {
+            if constexpr (!copy_on_write && std::is_trivially_destructible_v<T>
+                          && requires(leaf_allocator &allocator) { { allocator.release() } -> std::same_as<bool>; }) {
+                return allocator_.release();
+            } else {
+                return false;
+            }
+        }
 
-            for (size_t i = 1; i < right_child->key_num_; ++i) {
-                right_child->keys_[i - 1] = right_child->keys_[i];
+        // A node with the keys and subtree counts of node, but no
+        // children yet.
+        [[nodiscard]] Node *copy_node(Node const *node) {
+            Node *copy = make_sibling(node);
+            try {
+                copy->copy_keys(node);
+            } catch (...) {
+                free(copy);
+                throw;
             }
-            if (right_child->is_internal_node()) {
-                center_child->children_[center_child->key_num_] = right_child->children_[0];
-                for (size_t i = 1; i <= right_child->key_num_; ++i) {
-                    right_child->children_[i - 1] = right_child->children_[i];
+            if (node->is_internal_node()) copy->as_internal()->counts_ = node->as_internal()->counts_;
+            return copy;
+        }
+
+        [[nodiscard]] Node *clone(Node const *node) {
+            assert(node->key_num_ != 0);
+            Node *copy = copy_node(node);
+            if (node->is_internal_node()) {
+                for (size_t i = 0; i <= node->key_num_; ++i) {
+                    copy->as_internal()->children_[i] = clone(node->child(i));
                 }
             }
-            --right_child->key_num_;
+            return copy;
         }
 
-        Node *children_[max_children]{};
-        T *keys_;
-        size_t key_num_{};
+        // Another reference to the node, for a copy of the tree.
+        [[nodiscard]] Node *share(Node *node) noexcept requires copy_on_write {
+            node->shares_.fetch_add(1, std::memory_order_relaxed);
+            return node;
+        }
 
-        friend class BTree;
+        // The node if nothing else refers to it, otherwise a copy of it
+        // sharing its children, which takes its place in this tree.
+        [[nodiscard]] Node *own(Node *node) requires copy_on_write {
+            if (!node->is_shared()) return node;
+            Node *copy = copy_node(node);
+            if (node->is_internal_node()) {
+                for (size_t i = 0; i <= node->key_num_; ++i) {
+                    copy->as_internal()->children_[i] = share(node->child(i));
+                }
+            }
+            destroy(node);
+            return copy;
+        }
+
+    private:
+        [[no_unique_address]] leaf_allocator allocator_;
     };
 
+public:
     struct const_iterator {
-        // Iteration is somewhat slow, but it's not like anyone moves
-        // a reverse iterator around randomly when using a B-tree.
+        // The iterator keeps the path from the root down to its key in an
+        // array, so it neither allocates nor needs parent links in the
+        // nodes. The end iterator has an empty path, which makes end() and
+        // comparing with it O(1), like comparing with std::default_sentinel.
         using iterator_category = std::bidirectional_iterator_tag;
         using difference_type = std::ptrdiff_t;
         using value_type = T const;
         using pointer = value_type *;
         using reference = value_type &;
 
-        const_iterator(const_iterator const &) = default;
+        const_iterator() noexcept = default;
 
-        const_iterator &operator--() {
-            iter_info const &last = state_.top();
-            if (last.node->is_leaf_node()) {
-                if (last.key_index == 0) {
-                    while (state_.top().key_index == 0) {
-                        state_.pop();
-                    }
+        const_iterator(const_iterator const &other) noexcept: tree_(other.tree_), depth_(other.depth_) {
+            std::copy_n(other.path_, depth_, path_);
+        }
+
+        const_iterator &operator=(const_iterator const &other) noexcept {
+            tree_ = other.tree_;
+            depth_ = other.depth_;
+            std::copy_n(other.path_, depth_, path_);
+            return *this;
+        }
+
+        const_iterator &operator--() noexcept {
+            if (depth_ == 0) {
+                // From the end to the last key.
+                Node *node = tree_->root_;
+                while (node->is_internal_node()) {
+                    push(node, node->key_num_);
+                    node = node->child(node->key_num_);
+                }
+                push(node, node->key_num_);
+            } else if (top().node->is_leaf_node()) {
+                while (top().key_index == 0) {
+                    --depth_;
                 }
             } else {
-                Node *node = last.node->children_[last.key_index];
+                Node *node = top().node->child(top().key_index);
                 while (node->is_internal_node()) {
-                    state_.push({node, node->key_num_});
-                    node = node->children_[node->key_num_];
+                    push(node, node->key_num_);
+                    node = node->child(node->key_num_);
                 }
-                state_.push({node, node->key_num_});
+                push(node, node->key_num_);
             }
-            --state_.top().key_index;
+            --top().key_index;
             return *this;
         }
 
-        const_iterator operator--(int) {
+        const_iterator operator--(int) noexcept {
             const_iterator temp{*this};
             --(*this);
             return temp;
         }
 
-        const_iterator &operator++() {
-            iter_info &last = state_.top();
+        const_iterator &operator++() noexcept {
+            iter_info &last = top();
             ++last.key_index;
-            if (last.node == fin_node_) {
-                assert(fin_node_->is_leaf_node());
-                return *this;
-            }
             if (last.node->is_internal_node()) {
-                Node *node = last.node->children_[last.key_index];
+                Node *node = last.node->child(last.key_index);
                 while (node->is_internal_node()) {
-                    state_.push({node, 0});
-                    node = node->children_[0];
+                    push(node, 0);
+                    node = node->child(0);
                 }
-                state_.push({node, 0});
-            } else if (last.key_index == last.node->key_num_) {
-                while (state_.top().key_index == state_.top().node->key_num_)
-                    state_.pop();
+                push(node, 0);
+            } else {
+                skip_finished();
             }
             return *this;
         }
 
-        const_iterator operator++(int) {
+        const_iterator operator++(int) noexcept {
             const_iterator temp{*this};
             ++(*this);
             return temp;
         }
 
         reference operator*() const noexcept {
-            iter_info const &info = state_.top();
+            iter_info const &info = top();
             return info.node->keys_[info.key_index];
         }
 
         pointer operator->() const noexcept {
-            iter_info const &info = state_.top();
+            iter_info const &info = top();
             return info.node->keys_ + info.key_index;
         }
 
         friend bool operator==(const const_iterator &a, const const_iterator &b) noexcept {
-            assert(a.state_.empty() == b.state_.empty());
-            return a.state_.empty() && b.state_.empty()
-            || a.state_.size() == b.state_.size() && a.state_.top().node == b.state_.top().node
-               && a.state_.top().key_index == b.state_.top().key_index;
+            assert(a.tree_ == b.tree_);
+            return a.depth_ == b.depth_
+                   && (a.depth_ == 0 || (a.top().node == b.top().node && a.top().key_index == b.top().key_index));
         }
 
         friend bool operator!=(const const_iterator &a, const const_iterator &b) noexcept {
             return !(a == b);
         }
 
+        friend bool operator==(const const_iterator &it, std::default_sentinel_t) noexcept {
+            return it.depth_ == 0;
+        }
+
     private:
         enum class TreePlace {
             // Avoid ambiguities with booleans (though using a boolean B-tree is silly).
@@ -316,81 +601,143 @@ class BTree {
             End,
         };
 
-        const_iterator(BTree const &tree, T const &value) : fin_node_(get_last_node(tree.root_)) {
+        enum class Bound {
+            Lower,  // the first key not less than the value
+            Upper,  // the first key greater than the value
+        };
+
+        // Descends to where the value would go among the leaf's keys, and
+        // walks back up to the next key if that is past the leaf's end.
+        template<typename K>
+        const_iterator(BTree const &tree, K const &value, Bound bound) : tree_(&tree) {
             Node *node = tree.root_;
             while (node != nullptr) {
-                size_t index = tree.find_index(node, value);
-                state_.push({node, index});
-                if (index != node->key_num_ && tree.equals(node->keys_[index], value)) {
-                    node = node->children_[index];
-                    while (node != nullptr && (index = tree.find_index(node, value)) != node->key_num_) {
-                        state_.push({node, index});
-                        node = node->children_[index];
-                    }
-                    return;
-                }
-                node = node->children_[index];
+                size_t index = bound == Bound::Lower ? tree.find_index(node, value) : tree.find_upper_index(node, value);
+                push(node, index);
+                node = node->child_below(index);
             }
-            state_ = std::move(tree.end().state_);
+            skip_finished();
         }
 
-        const_iterator(BTree const &tree, TreePlace place) : fin_node_(get_last_node(tree.root_)) {
-            if (tree.root_ == nullptr) return;
-            Node *node = tree.root_;
-            if (place == TreePlace::Begin) {
-                while (!node->is_leaf_node()) {
-                    state_.push({node, 0});
-                    node = node->children_[0];
-                }
-                state_.push({node, 0});
-            } else {
-                while (node->is_internal_node()) {
-                    state_.push({node, node->key_num_});
-                    node = node->children_[node->key_num_];
-                }
-                assert(node == fin_node_);
-                state_.push({node, node->key_num_});
+        const_iterator(BTree const &tree, TreePlace place) noexcept: tree_(&tree) {
+            if (place == TreePlace::End) return;
+            for (Node *node = tree.root_; node != nullptr; node = node->child_below(0)) {
+                push(node, 0);
             }
         }
 
-        [[nodiscard]] const Node *get_last_node(const Node *node) const {
-            if (node == nullptr) return nullptr;
-            while (node->is_internal_node())
-                node = node->children_[node->key_num_];
-            return node;
-        };
-
         struct iter_info {
             Node *node;
             size_t key_index;
         };
 
-        std::stack<iter_info> state_{};
-        const Node *fin_node_;
+        void push(Node *node, size_t key_index) noexcept {
+            assert(depth_ < max_height);
+            path_[depth_++] = {node, key_index};
+        }
+
+        [[nodiscard]] iter_info &top() noexcept {
+            return path_[depth_ - 1];
+        }
+
+        [[nodiscard]] iter_info const &top() const noexcept {
+            return path_[depth_ - 1];
+        }
+
+        // Whether no key comes before this one, which is quicker to tell
+        // than going down to begin().
+        [[nodiscard]] bool at_first() const noexcept {
+            return depth_ != 0 && top().node->is_leaf_node()
+                   && std::all_of(path_, path_ + depth_, [](iter_info const &info) { return info.key_index == 0; });
+        }
+
+        // Leaves the nodes whose keys have all been passed, which may
+        // leave nothing but the end.
+        void skip_finished() noexcept {
+            while (depth_ != 0 && top().key_index == top().node->key_num_) {
+                --depth_;
+            }
+        }
+
+        BTree const *tree_ = nullptr;
+        size_t depth_ = 0;
+        iter_info path_[max_height];
 
         friend class BTree;
     };
 
     using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    // Keys cannot be changed in place, so iterators are all const.
+    using iterator = const_iterator;
+    using reverse_iterator = const_reverse_iterator;
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using allocator_type = Allocator;
 
-public:
     BTree() = default;
 
-    explicit BTree(Comparator comparator) : comparator_(comparator) {}
+    explicit BTree(Comparator comparator, Allocator const &allocator = Allocator())
+            : nodes_(allocator), comparator_(comparator) {}
+
+    explicit BTree(Allocator const &allocator) : nodes_(allocator) {}
+
+    // Builds the tree bottom-up from a sorted range in linear time, see
+    // assign_sorted.
+    template<std::input_iterator Iterator, std::sentinel_for<Iterator> Sentinel>
+    BTree(from_sorted_t, Iterator first, Sentinel last, double fill_factor = 1.0,
+          Comparator comparator = Comparator(), Allocator const &allocator = Allocator())
+            : nodes_(allocator), comparator_(comparator) {
+        assign_sorted(std::ranges::subrange(std::move(first), std::move(last)), fill_factor);
+    }
+
+    // The same, built on several threads, see assign_sorted(parallel_t).
+    template<std::input_iterator Iterator, std::sentinel_for<Iterator> Sentinel>
+    BTree(from_sorted_t, parallel_t execution, Iterator first, Sentinel last, double fill_factor = 1.0,
+          Comparator comparator = Comparator(), Allocator const &allocator = Allocator())
+            : nodes_(allocator), comparator_(comparator) {
+        assign_sorted(execution, std::ranges::subrange(std::move(first), std::move(last)), fill_factor);
+    }
+
+    // Shared nodes get freed by whichever tree drops them last, so
+    // copy-on-write copies keep the allocator they came from.
+    BTree(const BTree &other) requires std::copyable<T>
+            : nodes_(copy_on_write
+                     ? other.get_allocator()
+                     : std::allocator_traits<Allocator>::select_on_container_copy_construction(other.get_allocator())),
+              comparator_(other.comparator_) {
+        if (other.root_ != nullptr) {
+            if constexpr (copy_on_write) root_ = nodes_.share(other.root_);
+            else root_ = nodes_.clone(other.root_);
+        }
+        size_ = other.size_;
+    }
 
-    BTree(const BTree &other) : root_(other.root_ == nullptr ? nullptr : other.root_->clone()),
-                                comparator_(other.comparator_) {}
+    // A copy made on several threads, each copying subtrees of its own.
+    // Copy-on-write trees are copied in O(1) anyway.
+    [[nodiscard]] BTree clone([[maybe_unused]] parallel_t execution) const requires std::copyable<T> {
+        if constexpr (copy_on_write || !parallel_allocator) {
+            return BTree(*this);
+        } else {
+            if (size_ < min_parallel_size) return BTree(*this);
+            BTree copy(comparator_,
+                       std::allocator_traits<Allocator>::select_on_container_copy_construction(get_allocator()));
+            copy.root_ = copy.clone(execution, root_);
+            copy.size_ = size_;
+            return copy;
+        }
+    }
 
-    BTree &operator=(const BTree &other) {
+    BTree &operator=(const BTree &other) requires std::copyable<T> {
         if (this != &other) {
             BTree(other).swap(*this);
         }
         return *this;
     }
 
-    BTree(BTree &&other) noexcept {
-        swap(other);
-    }
+    BTree(BTree &&other) noexcept
+            : root_(std::exchange(other.root_, nullptr)), size_(std::exchange(other.size_, 0)), nodes_(other.nodes_),
+              comparator_(other.comparator_) {}
 
     BTree &operator=(BTree &&other) noexcept {
         swap(other);
@@ -399,212 +746,1933 @@ public:
 
     void swap(BTree &other) noexcept {
         std::swap(root_, other.root_);
+        std::swap(size_, other.size_);
         std::swap(comparator_, other.comparator_);
+        if constexpr (std::allocator_traits<Allocator>::propagate_on_container_swap::value) {
+            std::swap(nodes_, other.nodes_);
+        }
+    }
+
+    [[nodiscard]] Allocator get_allocator() const {
+        return nodes_.get_allocator();
     }
 
     [[nodiscard]] bool empty() const {
         return root_ == nullptr;
     }
 
+    [[nodiscard]] size_t size() const noexcept {
+        return size_;
+    }
+
     const_iterator find(const T &value) const {
-        return const_iterator(*this, value);
+        return find<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    const_iterator find(K const &value) const {
+        const_iterator it = lower_bound(value);
+        if (it != end() && less(value, *it)) return end();
+        return it;
+    }
+
+    const_iterator lower_bound(T const &value) const {
+        return lower_bound<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    const_iterator lower_bound(K const &value) const {
+        return const_iterator(*this, value, const_iterator::Bound::Lower);
+    }
+
+    const_iterator upper_bound(T const &value) const {
+        return upper_bound<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    const_iterator upper_bound(K const &value) const {
+        return const_iterator(*this, value, const_iterator::Bound::Upper);
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(T const &value) const {
+        return equal_range<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    std::pair<const_iterator, const_iterator> equal_range(K const &value) const {
+        return {lower_bound(value), upper_bound(value)};
     }
 
     bool contains(const T &value) const noexcept {
+        return contains<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    bool contains(K const &value) const noexcept {
         Node *cur_node = root_;
         while (cur_node != nullptr) {
-            size_t index = find_index(cur_node, value);
-            if (index != cur_node->key_num_ && equals(cur_node->keys_[index], value)) {
-                return true;
-            }
-            cur_node = cur_node->children_[index];
+            auto const [index, found] = find_slot(cur_node, value);
+            if (found) return true;
+            cur_node = cur_node->child_below(index);
         }
         return false;
     }
 
-    void insert(const T &value) {
-        if (root_ == nullptr) {
-            root_ = new Node(value);
-            return;
-        }
+    // The number of keys less than value.
+    [[nodiscard]] size_t rank(T const &value) const requires counted {
+        return rank<T>(value);
+    }
 
-        if (root_->is_full()) {
-            root_ = new Node(root_);
+    template<typename K> requires lookup_key<K> && counted
+    [[nodiscard]] size_t rank(K const &value) const {
+        size_t rank = 0;
+        for (Node const *node = root_; node != nullptr;) {
+            size_t const index = find_index(node, value);
+            rank += index;
+            if (node->is_leaf_node()) break;
+            InternalNode const *internal = node->as_internal();
+            rank = std::accumulate(internal->counts_.begin(), internal->counts_.begin() + index, rank);
+            node = internal->children_[index];
         }
+        return rank;
+    }
 
-        Node *cur_node = root_;
-        while (cur_node->is_internal_node()) {
-            cur_node = get_insertion_child(cur_node, value);
+    // The key at position index in iteration order, or end() if there are
+    // not that many.
+    [[nodiscard]] const_iterator nth(size_t index) const requires counted {
+        const_iterator it = end();
+        if (index >= size_) return it;
+        Node *node = root_;
+        while (node->is_internal_node()) {
+            InternalNode const *internal = node->as_internal();
+            size_t i = 0;
+            for (; index > internal->counts_[i]; ++i) {
+                index -= internal->counts_[i] + 1;
+            }
+            it.push(node, i);
+            if (index == internal->counts_[i]) return it;
+            node = internal->children_[i];
         }
-        insert_leaf(cur_node, value);
+        it.push(node, index);
+        return it;
     }
 
-    void remove(T const &value) {
-        if (root_ == nullptr) return;
+    // The number of keys in [low, high).
+    [[nodiscard]] size_t count_range(T const &low, T const &high) const requires counted {
+        return count_range<T>(low, high);
+    }
+
+    template<typename K> requires lookup_key<K> && counted
+    [[nodiscard]] size_t count_range(K const &low, K const &high) const {
+        if (!less(low, high)) return 0;
+        return rank(high) - rank(low);
+    }
+
+    void insert(T const &value) {
+        insert_value(value);
+    }
+
+    void insert(T &&value) {
+        insert_value(std::move(value));
+    }
+
+    // Inserts value right before hint if it belongs there, following the
+    // path of hint instead of searching, and where it belongs otherwise.
+    // Returns the iterator to it. end() makes a good hint for keys that
+    // keep growing, and the iterator after the last insert for sorted runs
+    // of keys.
+    const_iterator insert(const_iterator hint, T const &value) {
+        return insert_hinted(hint, value);
+    }
+
+    const_iterator insert(const_iterator hint, T &&value) {
+        return insert_hinted(hint, std::move(value));
+    }
+
+    // Constructs the key from args, which then only gets moved around.
+    template<typename... Args>
+    void emplace(Args &&... args) {
+        insert_value(T(std::forward<Args>(args)...));
+    }
+
+
+    // Removes one occurrence of value, returns whether there was one.
+    bool remove(T const &value) {
+        return remove<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    bool remove(K const &value) {
+        if (root_ == nullptr) return false;
+        own_root();
 
         if (root_->key_num_ == 1) {
             if (root_->is_leaf_node()) {
-                if (equals(root_->keys_[0], value)) {
-                    delete root_;
-                    root_ = nullptr;
-                }
-                return;
-            } else if (root_->children_[0]->key_num_ == min_keys && root_->children_[1]->key_num_ == min_keys) {
-                root_->merge_child_with_right(0);
-                Node *old_root = root_;
+                if (!equals(root_->keys_[0], value)) return false;
+                nodes_.free(root_);
+                root_ = nullptr;
+                size_ = 0;
+                return true;
+            } else if (root_->child(0)->key_num_ == min_keys && root_->child(1)->key_num_ == min_keys) {
+                InternalNode *old_root = root_->as_internal();
+                old_root->merge_child_with_right(0, nodes_);
                 root_ = old_root->children_[0];
-                delete old_root;
+                nodes_.free(old_root);
                 assert(root_->key_num_ > 1);
             }
         }
 
+        Path path;
         Node *cur_node = root_;
-        size_t index = find_index(cur_node, value);
+        Slot slot = find_slot(cur_node, value);
+        size_t index = slot.index;
         while (cur_node->is_internal_node()) {
             assert(cur_node == root_ || cur_node->key_num_ > min_keys);
-            if (index < cur_node->key_num_ && equals(cur_node->keys_[index], value)) {
-                auto const &left_child = cur_node->children_[index];
-                auto const &right_child = cur_node->children_[index + 1];
+            InternalNode *const cur_internal = cur_node->as_internal();
+            if (slot.found) {
+                Node *const left_child = cur_internal->children_[index];
+                Node *const right_child = cur_internal->children_[index + 1];
                 if (left_child->key_num_ > min_keys) {
-                    move_predecessor(left_child, cur_node->keys_[index]);
-                    return;
+                    path.push(cur_internal, index);
+                    move_predecessor(cur_internal->own_child(index, nodes_), cur_node->keys_[index], path);
+                } else if (right_child->key_num_ > min_keys) {
+                    path.push(cur_internal, index + 1);
+                    move_successor(cur_internal->own_child(index + 1, nodes_), cur_node->keys_[index], path);
+                } else {
+                    assert(left_child->key_num_ == min_keys);
+                    assert(right_child->key_num_ == min_keys);
+                    //           0 ->4<- 8 ...
+                    //              / \
+                    // 1 2 3 _ _ _ _   5 6 7 _ _ _ _
+                    cur_internal->merge_child_with_right(index, nodes_);
+                    //                   0 8 ...
+                    //                  / \
+                    // 1 2 3 ->4<- 5 6 7    (right is deleted)
+                    path.push(cur_internal, index);
+                    remove_middle_key(cur_internal->children_[index], path);
                 }
-                if (right_child->key_num_ > min_keys) {
-                    move_successor(right_child, cur_node->keys_[index]);
-                    return;
-                }
-                assert(left_child->key_num_ == min_keys);
-                assert(right_child->key_num_ == min_keys);
-                //           0 ->4<- 8 ...
-                //              / \
-                // 1 2 3 _ _ _ _   5 6 7 _ _ _ _
-                cur_node->merge_child_with_right(index);
-                //                   0 8 ...
-                //                  / \
-                // 1 2 3 ->4<- 5 6 7    (right is deleted)
-                remove_middle_key(left_child);
-                return;
+                // Only now that nothing can throw anymore.
+                path.add(-1);
+                --size_;
+                return true;
             }
-            cur_node->ensure_child_full(index);
-            cur_node = cur_node->children_[std::min(index, cur_node->key_num_)];
-            index = find_index(cur_node, value);
+            cur_internal->ensure_child_full(index, nodes_);
+            index = std::min(index, cur_node->key_num_);
+            path.push(cur_internal, index);
+            cur_node = cur_internal->children_[index];
+            slot = find_slot(cur_node, value);
+            index = slot.index;
         }
 
-        if (index < cur_node->key_num_ && equals(cur_node->keys_[index], value)) {
+        if (slot.found) {
             assert(cur_node == root_ || cur_node->key_num_ > min_keys);
             cur_node->remove_leaf(index);
+            path.add(-1);
+            --size_;
+            return true;
         }
-        // else not in tree
+        return false;  // not in tree
     }
 
-    void clear() {
-        delete root_;
-        root_ = nullptr;
+    // Inserts a batch of values in one pass over the tree: the batch is
+    // sorted (unless it already is) and split among the children along
+    // the way, so that each node on the way is visited, and split, at
+    // most once however many of the values land in it. The values are
+    // moved out of an rvalue container. Keys that can only be moved must
+    // compare without throwing.
+    template<std::ranges::input_range Range>
+    void insert_batch(Range &&range) {
+        std::vector<T> batch = sorted_batch(std::forward<Range>(range));
+        if (batch.empty()) return;
+        if (root_ == nullptr) {
+            root_ = build_sorted(std::make_move_iterator(batch.begin()), batch.size(), 1.0);
+            size_ = batch.size();
+            return;
+        }
+        try {
+            std::vector<Split> splits;
+            own_root();
+            insert_batch(root_, batch.data(), batch.data() + batch.size(), splits);
+            while (!splits.empty()) {
+                root_ = grow_root(splits);
+            }
+        } catch (...) {
+            // Some of the values made it in, and some may have been lost.
+            size_ = recount(root_);
+            throw;
+        }
+        size_ += batch.size();
     }
 
-    const_iterator begin() const { return const_iterator(*this, const_iterator::TreePlace::Begin); }
+    // Removes one occurrence of each value in the batch, like calling
+    // remove for each of them, but fixing up underfull nodes once per
+    // batch. Returns how many values were found. Comparisons and moves of
+    // the keys must not throw, and neither must copying the shared nodes
+    // it changes, with copy_on_write.
+    template<std::ranges::input_range Range>
+    size_t erase_batch(Range &&range) {
+        std::vector<T> batch = sorted_batch(std::forward<Range>(range));
+        if (root_ == nullptr || batch.empty()) return 0;
+        own_root();
+        size_t erased = 0;
+        erase_batch(root_, batch.data(), batch.data() + batch.size(), erased);
+        size_ -= erased;
+        drop_empty_roots();
+        return erased;
+    }
 
-    const_iterator end() const { return const_iterator(*this, const_iterator::TreePlace::End); }
+    // Removes the key at pos, returns the iterator to the key after it.
+    const_iterator erase(const_iterator pos) requires std::copy_constructible<T> || counted {
+        assert(pos != end());
+        return erase(pos, std::next(pos));
+    }
 
-    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    // Removes the keys in [first, last), returns the iterator to the key
+    // that was at last. The subtrees entirely in between are dropped
+    // whole, and only the nodes on the paths to first and last get
+    // rebalanced, so this takes O(log N) besides destroying the keys.
+    // Moves of the keys must not throw, and neither must copying the
+    // shared nodes on the paths, with copy_on_write. Unless the tree is
+    // counted, finding last again takes a copy of its key and a walk over
+    // the keys equal to it left of first.
+    const_iterator erase(const_iterator first, const_iterator last) requires std::copy_constructible<T> || counted {
+        if (first == last) return last;
+        if (last == end()) {
+            erase_between(first, last);
+            return end();
+        }
+        if constexpr (counted) {
+            size_t const index = index_of(first);
+            erase_between(first, last);
+            return nth(index);
+        } else {
+            T const key = *last;
+            size_t equal_before = 0;
+            const_iterator it = lower_bound(key);
+            for (; it != first && it != last; ++it) {
+                ++equal_before;
+            }
+            if (it == last) equal_before = 0;
+            erase_between(first, last);
+            it = lower_bound(key);
+            std::advance(it, equal_before);
+            return it;
+        }
+    }
 
-    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+    // Removes the keys in [low, high) like erase(first, last), returns how
+    // many there were.
+    size_t erase_range(T const &low, T const &high) {
+        return erase_range<T>(low, high);
+    }
 
-    ~BTree() {
-        delete root_;
+    template<typename K> requires lookup_key<K>
+    size_t erase_range(K const &low, K const &high) {
+        if (!less(low, high)) return 0;
+        const_iterator const first = lower_bound(low);
+        const_iterator const last = lower_bound(high);
+        if (first == last) return 0;
+        size_t const size = size_;
+        erase_between(first, last);
+        return size - size_;
     }
 
-private:
-    Node *root_ = nullptr;
-    Comparator comparator_{};
+    // Moves the keys less than key into the first tree returned, and the
+    // rest into the second, leaving this one empty. Only the nodes on the
+    // path to key get cut in two, and their pieces joined back up with
+    // the subtrees hanging off them, which takes O(log N). The trees
+    // returned then need their sizes, which counted trees (see
+    // order_statistics_policy) have at hand; others count the keys of the
+    // smaller one, so their split takes O(log N + the smaller size).
+    // Running out of memory once the tree is in pieces leaves it empty.
+    [[nodiscard]] std::pair<BTree, BTree> split(T const &key) && {
+        return std::move(*this).template split<T>(key);
+    }
 
-    void remove_middle_key(Node *cur_node) {
-        while (cur_node->is_internal_node()) {
-            size_t const middle = cur_node->key_num_ / 2;
-            auto const &left_child = cur_node->children_[middle];
-            auto const &right_child = cur_node->children_[middle + 1];
-            if (left_child->key_num_ > min_keys) {
-                move_predecessor(left_child, cur_node->keys_[middle]);
-                return;
-            }
-            if (right_child->key_num_ > min_keys) {
-                move_successor(right_child, cur_node->keys_[middle]);
-                return;
-            }
-            cur_node->merge_child_with_right(middle);
-            cur_node = left_child;
+    template<typename K> requires lookup_key<K>
+    [[nodiscard]] std::pair<BTree, BTree> split(K const &key) && {
+        std::pair<BTree, BTree> parts{BTree(comparator_, get_allocator()), BTree(comparator_, get_allocator())};
+        if (root_ == nullptr) return parts;
+        own_root();
+        size_t const size = std::exchange(size_, 0);
+        auto const [lower, upper] = split_node(std::exchange(root_, nullptr), key);
+        parts.first.root_ = lower.root;
+        parts.second.root_ = upper.root;
+        if constexpr (counted) {
+            parts.first.size_ = lower.size;
+            parts.second.size_ = upper.size;
+        } else {
+            std::tie(parts.first.size_, parts.second.size_) = count_apart(lower.root, upper.root, size);
         }
-        cur_node->remove_leaf(cur_node->key_num_ / 2);
+        return parts;
     }
 
-    void move_predecessor(Node *node, T &move_to) {
-        while (node->is_internal_node()) {
-            node->ensure_child_full(node->key_num_);
-            node = node->children_[node->key_num_];
+    // Joins two trees, no key of left being greater than any of right,
+    // into one by hanging the lower tree off the edge of the other at its
+    // level, in O(log N). Unless one of them is empty, the trees have to
+    // have equal allocators to take each other's nodes, and throw
+    // std::invalid_argument otherwise. Running out of memory on the way
+    // leaves both trees empty.
+    [[nodiscard]] friend BTree join(BTree &&left, BTree &&right) {
+        if (left.root_ == nullptr) return std::move(right);
+        if (right.root_ == nullptr) return std::move(left);
+        if constexpr (!std::allocator_traits<Allocator>::is_always_equal::value) {
+            if (left.get_allocator() != right.get_allocator()) {
+                throw std::invalid_argument("b_tree::join: the trees' allocators are not equal");
+            }
         }
-        move_to = node->keys_[node->key_num_ - 1];
-        assert(node->key_num_ > min_keys);
-        --node->key_num_;
+        assert(!left.less(*right.begin(), *std::prev(left.end())));
+        BTree joined(std::move(left));
+        Part lower{std::exchange(joined.root_, nullptr), std::exchange(joined.size_, 0)};
+        Part upper{nullptr, 0};
+        try {
+            right.own_root();
+            T separator = right.pop_min(right.root_);
+            --right.size_;
+            right.drop_empty_roots();
+            upper = {std::exchange(right.root_, nullptr), std::exchange(right.size_, 0)};
+            Part const root = joined.join_parts(lower, std::move(separator), upper);
+            joined.root_ = root.root;
+            joined.size_ = root.size;
+        } catch (...) {
+            joined.destroy_parts({lower, upper});
+            right.clear();
+            throw;
+        }
+        return joined;
     }
 
-    void move_successor(Node *node, T &move_to) {
-        while (node->is_internal_node()) {
-            node->ensure_child_full(0);
-            node = node->children_[0];
+    // Moves the keys of other into this tree, equal keys of both included.
+    // Trees with equal allocators whose keys do not interleave get joined
+    // in O(log N), others go through their keys in order into a new tree
+    // built bottom-up with this tree's allocator, in linear time. With the
+    // keys moved out of both, running out of memory on the way leaves
+    // both trees empty.
+    void merge(BTree &&other) {
+        if (get_allocator() == other.get_allocator()) {
+            if (ordered(*this, other, false)) {
+                *this = join(std::move(*this), std::move(other));
+                return;
+            }
+            if (ordered(other, *this, false)) {
+                *this = join(std::move(other), std::move(*this));
+                return;
+            }
         }
-        move_to = node->keys_[0];
-        assert(node->key_num_ > min_keys);
-        --node->key_num_;
-        for (size_t i = 0; i < node->key_num_; ++i) {
-            node->keys_[i] = node->keys_[i + 1];
+        size_t const count = size_ + other.size_;
+        Node *root;
+        try {
+            root = build_sorted(SetKeys<SetOperation::Merge, !copy_on_write>(*this, other), count, 1.0);
+        } catch (...) {
+            if constexpr (!copy_on_write) {
+                clear();
+                other.clear();
+            }
+            throw;
         }
+        // Not clear(), which may release the pool the new nodes came from.
+        nodes_.destroy(root_);
+        root_ = root;
+        size_ = count;
+        other.clear();
     }
 
-    Node *get_insertion_child(Node *node, const T &value) {  // D:
-        size_t index = find_index(node, value);
-        if (node->children_[index]->is_full()) {
-            node->split_child_right(index);
-            if (comparator_(node->keys_[index], value)) ++index;
+    // The set operations of the standard library on the keys of two
+    // trees, as many of each key as std::set_union etc. take, built bottom
+    // up into a single tree in linear time. Trees whose key ranges do not
+    // overlap have theirs copied whole, which copy-on-write trees sharing
+    // an allocator do in O(log N).
+    [[nodiscard]] friend BTree set_union(BTree const &left, BTree const &right) requires std::copyable<T> {
+        if constexpr (copy_on_write) {
+            // The copies share the nodes and allocators of left and right.
+            if (left.get_allocator() == right.get_allocator()) {
+                if (ordered(left, right, true)) return join(BTree(left), BTree(right));
+                if (ordered(right, left, true)) return join(BTree(right), BTree(left));
+            }
         }
-        return node->children_[index];
+        return left.template set_operation<SetOperation::Union>(right);
     }
 
-    void insert_leaf(Node *node, const T &value) {
-        size_t index = find_index(node, value);
-        for (size_t i = node->key_num_; i > index; --i) {
-            node->keys_[i] = node->keys_[i - 1];
+    [[nodiscard]] friend BTree set_intersection(BTree const &left, BTree const &right) requires std::copyable<T> {
+        if (ordered(left, right, true) || ordered(right, left, true)) {
+            return BTree(left.comparator_, std::allocator_traits<Allocator>::select_on_container_copy_construction(
+                    left.get_allocator()));
         }
-        ++node->key_num_;
-        node->keys_[index] = value;
+        return left.template set_operation<SetOperation::Intersection>(right);
     }
 
-    size_t find_index(Node const *node, T const &value) const noexcept(
-    noexcept(std::declval<Comparator>()(std::declval<T>(), std::declval<T>()))
+    [[nodiscard]] friend BTree set_difference(BTree const &left, BTree const &right) requires std::copyable<T> {
+        if (ordered(left, right, true) || ordered(right, left, true)) return BTree(left);
+        return left.template set_operation<SetOperation::Difference>(right);
+    }
+
+    // Replaces the contents with a sorted range in linear time. The nodes
+    // are packed to fill_factor of their capacity, as far as the minimum
+    // occupancy allows, so 1 builds the densest tree and 0.5 leaves the
+    // most room for inserts. The values are moved out of an rvalue
+    // container.
+    template<std::ranges::input_range Range>
+    void assign_sorted(Range &&range, double fill_factor = 1.0) {
+        Node *root;
+        size_t count;
+        if constexpr (std::ranges::sized_range<Range>) {
+            count = std::ranges::size(range);
+            root = build_sorted(begin_taking<Range>(range), count, fill_factor);
+        } else if constexpr (std::ranges::forward_range<Range>) {
+            count = static_cast<size_t>(std::ranges::distance(range));
+            root = build_sorted(begin_taking<Range>(range), count, fill_factor);
+        } else {
+            std::vector<T> buffer;
+            for (auto &&value: range) {
+                if constexpr (owns_elements<Range>) buffer.emplace_back(std::move(value));
+                else buffer.emplace_back(std::forward<decltype(value)>(value));
+            }
+            count = buffer.size();
+            root = build_sorted(std::make_move_iterator(buffer.begin()), count, fill_factor);
+        }
+        // Not clear(), which may release the pool the new nodes came from.
+        if (root_ != nullptr) nodes_.destroy(root_);
+        root_ = root;
+        size_ = count;
+    }
+
+    // assign_sorted on several threads: the subtrees of the highest level
+    // with nodes enough to go round get built on their own, then the
+    // levels above them. Only sized random access ranges can be split up
+    // like that, others get assigned on the calling thread.
+    template<std::ranges::input_range Range>
+    void assign_sorted(parallel_t execution, Range &&range, double fill_factor = 1.0) {
+        if constexpr (parallel_allocator && std::ranges::random_access_range<Range>
+                      && std::ranges::sized_range<Range>) {
+            size_t const count = std::ranges::size(range);
+            Node *root = build_sorted(execution, begin_taking<Range>(range), count, fill_factor);
+            if (root_ != nullptr) destroy(execution, root_, size_);
+            root_ = root;
+            size_ = count;
+        } else {
+            assign_sorted(std::forward<Range>(range), fill_factor);
+        }
+    }
+
+    void clear() {
+        if (root_ == nullptr) return;
+        if (!nodes_.release()) nodes_.destroy(root_);
+        root_ = nullptr;
+        size_ = 0;
+    }
+
+    // clear() on several threads, each freeing subtrees of its own.
+    void clear(parallel_t execution) {
+        if (root_ == nullptr) return;
+        if (!nodes_.release()) destroy(execution, root_, size_);
+        root_ = nullptr;
+        size_ = 0;
+    }
+
+    const_iterator begin() const { return const_iterator(*this, const_iterator::TreePlace::Begin); }
+
+    const_iterator end() const { return const_iterator(*this, const_iterator::TreePlace::End); }
+
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    ~BTree() {
+        clear();
+    }
+
+private:
+    Node *root_ = nullptr;
+    size_t size_ = 0;
+    NodeFactory nodes_{};
+    Comparator comparator_{};
+
+    // Number of nodes to spread items (children, or keys + 1 for leaves)
+    // over to fill them to fill_factor, or as close as the occupancy
+    // bounds allow.
+    static size_t level_width(size_t items, double fill_factor) noexcept {
+        if (items <= max_children) return 1;  // the root
+        auto const target = std::clamp(static_cast<size_t>(std::lround(fill_factor * max_children)),
+                                       min_children, max_children);
+        size_t const fewest = (items + max_children - 1) / max_children;
+        size_t const most = items / min_children;
+        return std::clamp((items + target / 2) / target, fewest, most);
+    }
+
+    // How a level of a tree built from sorted values is laid out: each of
+    // its width nodes gets share + (j < extra) children for node j, leaves
+    // as many keys plus one.
+    struct LevelShape {
+        size_t share;
+        size_t extra;
+        size_t width;
+
+        // The first item of node j, counting those of the nodes before it.
+        [[nodiscard]] size_t begin(size_t j) const noexcept {
+            return j * share + std::min(j, extra);
+        }
+    };
+
+    // The levels of a tree of count values from the leaves up.
+    static std::vector<LevelShape> sorted_shape(size_t count, double fill_factor) {
+        std::vector<LevelShape> levels;
+        for (size_t items = count + 1; items > 1;) {
+            size_t const width = level_width(items, fill_factor);
+            levels.push_back({items / width, items % width, width});
+            items = width;
+        }
+        return levels;
+    }
+
+    enum class SetOperation {
+        Merge,         // every key of both
+        Union,         // as many of each key as the tree with more of it has
+        Intersection,  // as many as the tree with fewer of it has
+        Difference,    // as many more as the first tree has
+    };
+
+    // Goes through the keys of two trees in order the way std::merge,
+    // std::set_union etc. do, as the input of build_sorted. The keys come
+    // out moved if move, for trees that are about to go.
+    template<SetOperation operation, bool move>
+    class SetKeys {
+    public:
+        SetKeys(BTree const &left, BTree const &right) : tree_(&left), left_(left.begin()), right_(right.begin()) {
+            settle();
+        }
+
+        decltype(auto) operator*() const noexcept {
+            T const &key = from_left_ ? *left_ : *right_;
+            if constexpr (move) return std::move(const_cast<T &>(key));
+            else return key;
+        }
+
+        SetKeys &operator++() {
+            if (from_left_) {
+                ++left_;
+                if (from_both_) ++right_;
+            } else {
+                ++right_;
+            }
+            settle();
+            return *this;
+        }
+
+        [[nodiscard]] bool done() const noexcept {
+            return done_;
+        }
+
+    private:
+        // Moves on to the next key that is part of the result.
+        void settle() {
+            from_both_ = false;
+            while (left_ != std::default_sentinel && right_ != std::default_sentinel) {
+                if (tree_->less(*left_, *right_)) {
+                    if (operation != SetOperation::Intersection) {
+                        from_left_ = true;
+                        return;
+                    }
+                    ++left_;
+                } else if (tree_->less(*right_, *left_)) {
+                    if (operation == SetOperation::Merge || operation == SetOperation::Union) {
+                        from_left_ = false;
+                        return;
+                    }
+                    ++right_;
+                } else if (operation == SetOperation::Difference) {
+                    ++left_;
+                    ++right_;
+                } else {
+                    // Merge takes the equal key of right on the next round.
+                    from_left_ = true;
+                    from_both_ = operation != SetOperation::Merge;
+                    return;
+                }
+            }
+            // The rest of one of them, if the operation takes it.
+            from_left_ = left_ != std::default_sentinel;
+            done_ = from_left_ ? operation == SetOperation::Intersection
+                               : right_ == std::default_sentinel || operation == SetOperation::Intersection
+                                 || operation == SetOperation::Difference;
+        }
+
+        BTree const *tree_;
+        const_iterator left_;
+        const_iterator right_;
+        bool from_left_ = false;
+        bool from_both_ = false;
+        bool done_ = false;
+    };
+
+    // Builds the result of a set operation on this tree and other from
+    // their keys in order, having counted them first.
+    template<SetOperation operation>
+    [[nodiscard]] BTree set_operation(BTree const &other) const {
+        BTree result(comparator_,
+                     std::allocator_traits<Allocator>::select_on_container_copy_construction(get_allocator()));
+        size_t count = 0;
+        for (SetKeys<operation, false> keys(*this, other); !keys.done(); ++keys) {
+            ++count;
+        }
+        result.root_ = result.build_sorted(SetKeys<operation, false>(*this, other), count, 1.0);
+        result.size_ = count;
+        return result;
+    }
+
+    // Whether no key of left is greater than any of right, or with
+    // strictly, equal to any either.
+    [[nodiscard]] static bool ordered(BTree const &left, BTree const &right, bool strictly) {
+        if (left.root_ == nullptr || right.root_ == nullptr) return true;
+        T const &left_max = *std::prev(left.end());
+        T const &right_min = *right.begin();
+        return strictly ? left.less(left_max, right_min) : !left.less(right_min, left_max);
+    }
+
+    // Builds a tree of count sorted values in a single pass. The shape of
+    // every level is worked out up front, then values are appended in
+    // order: each goes into the open leaf until it has its share of keys,
+    // after which the next value separates that leaf from the next one
+    // and goes into the lowest open ancestor that still expects keys.
+    template<typename Iterator>
+    Node *build_sorted(Iterator first, size_t count, double fill_factor) {
+        assert(fill_factor > 0 && fill_factor <= 1);
+        if (count == 0) return nullptr;
+
+        struct Level : LevelShape {
+            size_t done = 0;
+            Node *open = nullptr;
+            size_t children = 0;
+
+            [[nodiscard]] size_t keys() const noexcept {
+                return this->share + (done < this->extra) - 1;
+            }
+        };
+        std::vector<Level> levels;
+        for (LevelShape const &shape: sorted_shape(count, fill_factor)) {
+            levels.push_back(Level{shape});
+        }
+
+        // Hands a full node to its parent. Returns the node that gets the
+        // next key, or the root once all of them are done.
+        auto const finish = [&](size_t level) {
+            Node *node = levels[level].open;
+            levels[level].open = nullptr;
+            ++levels[level].done;
+            for (++level; level < levels.size(); ++level) {
+                Level &parent_level = levels[level];
+                if (parent_level.open == nullptr) {
+                    try {
+                        parent_level.open = nodes_.make_internal(level);
+                    } catch (...) {
+                        // Not on any level any more.
+                        nodes_.destroy(node);
+                        throw;
+                    }
+                }
+                InternalNode *parent = parent_level.open->as_internal();
+                size_t size = 0;
+                if constexpr (counted) size = InternalNode::subtree_size(node);
+                parent->set_child(parent_level.children++, node, size);
+                if (parent->key_num_ < parent_level.keys()) return parent_level.open;
+                node = parent;
+                parent_level.open = nullptr;
+                parent_level.children = 0;
+                ++parent_level.done;
+            }
+            return node;
+        };
+
+        Level &leaves = levels.front();
+        T const *previous = nullptr;
+        try {
+            for (size_t i = 0; i < count; ++i, ++first) {
+                Node *node = leaves.open;
+                if (node == nullptr) {
+                    node = leaves.open = nodes_.make_leaf();
+                } else if (node->key_num_ == leaves.keys()) {
+                    node = finish(0);
+                }
+                node->insert_key(node->key_num_, *first);
+                T const *const key = node->keys_ + node->key_num_ - 1;
+                assert(previous == nullptr || !less(*key, *previous));
+                previous = key;
+            }
+        } catch (...) {
+            for (auto &level: levels) {
+                if (level.open == nullptr) continue;
+                if (level.open->is_internal_node()) {
+                    for (size_t i = 0; i < level.children; ++i) {
+                        nodes_.destroy(level.open->child(i));
+                    }
+                }
+                nodes_.free(level.open);
+            }
+            throw;
+        }
+        assert(leaves.open->key_num_ == leaves.keys());
+        Node *const root = finish(0);
+        assert(static_cast<size_t>(root->level_) + 1 == levels.size());
+        return root;
+    }
+
+    template<typename Iterator>
+    Node *build_sorted(parallel_t execution, Iterator first, size_t count, double fill_factor) {
+        assert(fill_factor > 0 && fill_factor <= 1);
+        if (count < min_parallel_size) return build_sorted(std::move(first), count, fill_factor);
+        std::vector<LevelShape> const levels = sorted_shape(count, fill_factor);
+        size_t const top = levels.size() - 1;
+        size_t built = top;
+        while (built != 0 && levels[built].width < detail::task_count(execution)) {
+            --built;
+        }
+        std::vector<Node *> nodes(levels[built].width);
+        try {
+            detail::parallel_for(execution, nodes.size(), [&](size_t i) {
+                nodes[i] = build_node(levels, built, i, first, nullptr);
+            });
+            return build_node(levels, top, 0, first, nodes.data(), built);
+        } catch (...) {
+            for (Node *node: nodes) {
+                if (node != nullptr) nodes_.destroy(node);
+            }
+            throw;
+        }
+    }
+
+    // Builds node index of a level of the tree that build_sorted makes out
+    // of the values at first. The nodes of level built are taken out of
+    // nodes instead, if there are any. Frees what it made if it throws.
+    template<typename Iterator>
+    Node *build_node(std::vector<LevelShape> const &levels, size_t level, size_t index, Iterator const &first,
+                     Node **nodes, size_t built = 0) {
+        if (nodes != nullptr && level == built) return std::exchange(nodes[index], nullptr);
+        LevelShape const &shape = levels[level];
+        if (level == 0) {
+            Node *leaf = nodes_.make_leaf();
+            try {
+                // The item after the keys is the separator that follows.
+                for (size_t i = shape.begin(index), end = shape.begin(index + 1) - 1; i != end; ++i) {
+                    leaf->insert_key(leaf->key_num_, first[i]);
+                }
+            } catch (...) {
+                nodes_.free(leaf);
+                throw;
+            }
+            return leaf;
+        }
+        InternalNode *node = nodes_.make_internal(level);
+        size_t const first_child = shape.begin(index);
+        size_t const children = shape.begin(index + 1) - first_child;
+        size_t made = 0;
+        try {
+            for (; made < children; ++made) {
+                size_t const child = first_child + made;
+                if (made != 0) node->insert_key(made - 1, first[first_item(levels, level - 1, child) - 1]);
+                Node *child_node = build_node(levels, level - 1, child, first, nodes, built);
+                size_t size = 0;
+                if constexpr (counted) size = InternalNode::subtree_size(child_node);
+                node->set_child(made, child_node, size);
+            }
+        } catch (...) {
+            for (size_t i = 0; i < made; ++i) {
+                nodes_.destroy(node->children_[i]);
+            }
+            nodes_.free(node);
+            throw;
+        }
+        return node;
+    }
+
+    // The index of the first value under node index of a level.
+    static size_t first_item(std::vector<LevelShape> const &levels, size_t level, size_t index) noexcept {
+        for (; level != 0; --level) {
+            index = levels[level].begin(index);
+        }
+        return levels[0].begin(index);
+    }
+
+    // The top levels of a tree, breadth-first, and the subtrees below
+    // them, at least count of them if the tree is that wide. Shared nodes
+    // are left whole, however high up they are.
+    struct Fanout {
+        std::vector<Node *> top;
+        std::vector<Node *> subtrees;
+    };
+
+    static Fanout fan_out(Node *root, size_t count) {
+        Fanout fanout;
+        fanout.subtrees.push_back(root);
+        std::vector<Node *> below;
+        while (fanout.subtrees.size() < count) {
+            below.clear();
+            for (Node *node: fanout.subtrees) {
+                if (node->is_leaf_node() || node->is_shared()) {
+                    below.push_back(node);
+                    continue;
+                }
+                fanout.top.push_back(node);
+                for (size_t i = 0; i <= node->key_num_; ++i) {
+                    below.push_back(node->child(i));
+                }
+            }
+            if (below.size() == fanout.subtrees.size()) break;
+            std::swap(below, fanout.subtrees);
+        }
+        return fanout;
+    }
+
+    // nodes_.clone(root) with the subtrees below the top levels copied on
+    // threads of their own.
+    Node *clone(parallel_t execution, Node *root) {
+        Fanout const fanout = fan_out(root, detail::task_count(execution));
+        std::vector<Node *> top;
+        std::vector<Node *> subtrees(fanout.subtrees.size());
+        top.reserve(fanout.top.size());
+        try {
+            for (Node *node: fanout.top) {
+                top.push_back(nodes_.copy_node(node));
+            }
+            detail::parallel_for(execution, subtrees.size(), [&](size_t i) {
+                subtrees[i] = nodes_.clone(fanout.subtrees[i]);
+            });
+        } catch (...) {
+            for (Node *node: subtrees) {
+                if (node != nullptr) nodes_.destroy(node);
+            }
+            for (Node *node: top) {
+                nodes_.free(node);
+            }
+            throw;
+        }
+        // Breadth-first, the children of the top nodes are the top nodes
+        // but the root, then the subtrees.
+        size_t next = 1;
+        for (Node *node: top) {
+            for (size_t i = 0; i <= node->key_num_; ++i, ++next) {
+                node->as_internal()->children_[i] = next < top.size() ? top[next] : subtrees[next - top.size()];
+            }
+        }
+        return top.empty() ? subtrees.front() : top.front();
+    }
+
+    // nodes_.destroy(root) for a tree of size keys, with the subtrees below
+    // the top levels freed on threads of their own.
+    void destroy([[maybe_unused]] parallel_t execution, Node *root, [[maybe_unused]] size_t size) noexcept {
+        if constexpr (parallel_allocator) {
+            if (size >= min_parallel_size) {
+                try {
+                    Fanout const fanout = fan_out(root, detail::task_count(execution));
+                    detail::parallel_for(execution, fanout.subtrees.size(), [&](size_t i) {
+                        nodes_.destroy(fanout.subtrees[i]);
+                    });
+                    for (Node *node: fanout.top) {
+                        nodes_.free(node);
+                    }
+                    return;
+                } catch (std::bad_alloc const &) {
+                    // No room for the fan-out, before anything was freed.
+                }
+            }
+        }
+        nodes_.destroy(root);
+    }
+
+    // The children a descent went through, so that their subtree counts
+    // can be adjusted once it is known whether a key came or went.
+    class Path {
+    public:
+        void push([[maybe_unused]] InternalNode *node, [[maybe_unused]] size_t index) noexcept {
+            if constexpr (counted) {
+                assert(depth_ < max_height);
+                steps_[depth_++] = {node, index};
+            }
+        }
+
+        void add([[maybe_unused]] ptrdiff_t delta) noexcept {
+            if constexpr (counted) {
+                for (size_t i = 0; i < depth_; ++i) {
+                    steps_[i].node->counts_[steps_[i].index] += delta;
+                }
+            }
+        }
+
+    private:
+        struct Step {
+            InternalNode *node;
+            size_t index;
+        };
+
+        [[no_unique_address]] std::conditional_t<counted, std::array<Step, max_height>, Empty> steps_;
+        [[no_unique_address]] std::conditional_t<counted, size_t, Empty> depth_{};
+    };
+
+    // The remove helpers add the children they go down to to path, whose
+    // counts the caller adjusts once the key is gone.
+    void remove_middle_key(Node *cur_node, Path &path) {
+        while (cur_node->is_internal_node()) {
+            InternalNode *const cur_internal = cur_node->as_internal();
+            size_t const middle = cur_node->key_num_ / 2;
+            Node *const left_child = cur_internal->children_[middle];
+            Node *const right_child = cur_internal->children_[middle + 1];
+            if (left_child->key_num_ > min_keys) {
+                path.push(cur_internal, middle);
+                move_predecessor(cur_internal->own_child(middle, nodes_), cur_node->keys_[middle], path);
+                return;
+            }
+            if (right_child->key_num_ > min_keys) {
+                path.push(cur_internal, middle + 1);
+                move_successor(cur_internal->own_child(middle + 1, nodes_), cur_node->keys_[middle], path);
+                return;
+            }
+            cur_internal->merge_child_with_right(middle, nodes_);
+            path.push(cur_internal, middle);
+            cur_node = cur_internal->children_[middle];
+        }
+        cur_node->remove_leaf(cur_node->key_num_ / 2);
+    }
+
+    void move_predecessor(Node *node, T &move_to, Path &path) {
+        while (node->is_internal_node()) {
+            node->as_internal()->ensure_child_full(node->key_num_, nodes_);
+            path.push(node->as_internal(), node->key_num_);
+            node = node->child(node->key_num_);
+        }
+        assert(node->key_num_ > min_keys);
+        move_to = std::move(node->keys_[node->key_num_ - 1]);
+        node->remove_leaf(node->key_num_ - 1);
+    }
+
+    void move_successor(Node *node, T &move_to, Path &path) {
+        while (node->is_internal_node()) {
+            node->as_internal()->ensure_child_full(0, nodes_);
+            path.push(node->as_internal(), 0);
+            node = node->child(0);
+        }
+        assert(node->key_num_ > min_keys);
+        move_to = std::move(node->keys_[0]);
+        node->remove_leaf(0);
+    }
+
+    // Counts the keys of a subtree, and sets its subtree counts while at
+    // it.
+    size_t recount(Node *node) noexcept {
+        if (node == nullptr) return 0;
+        if (node->is_leaf_node()) return node->key_num_;
+        size_t size = node->key_num_;
+        for (size_t i = 0; i <= node->key_num_; ++i) {
+            size_t const child_size = recount(node->child(i));
+            if constexpr (counted) node->as_internal()->counts_[i] = child_size;
+            size += child_size;
+        }
+        return size;
+    }
+
+    // The elements of a range argument are moved out of it if it is an
+    // rvalue that owns them, like a container, and copied otherwise.
+    template<typename Range>
+    static constexpr bool owns_elements =
+            !std::is_lvalue_reference_v<Range> && !std::ranges::view<std::remove_cvref_t<Range>>;
+
+    template<typename Range>
+    static auto begin_taking(std::remove_reference_t<Range> &range) {
+        if constexpr (owns_elements<Range>) return std::make_move_iterator(std::ranges::begin(range));
+        else return std::ranges::begin(range);
+    }
+
+    // A node split off by a batch insert, to be put after its sibling.
+    struct Split {
+        T separator;
+        Node *node;
+    };
+
+    template<typename Range>
+    std::vector<T> sorted_batch(Range &&range) const {
+        std::vector<T> batch;
+        if constexpr (std::ranges::sized_range<Range>) {
+            batch.reserve(std::ranges::size(range));
+        }
+        for (auto &&value: range) {
+            if constexpr (owns_elements<Range>) batch.emplace_back(std::move(value));
+            else batch.emplace_back(std::forward<decltype(value)>(value));
+        }
+        if (!std::is_sorted(batch.begin(), batch.end(), key_less())) {
+            std::stable_sort(batch.begin(), batch.end(), key_less());
+        }
+        return batch;
+    }
+
+    // Inserts the sorted values [first, last) into the subtree of node.
+    // Whatever no longer fits into node goes into new siblings, which are
+    // added to splits for the parent to take. If this throws, the nodes
+    // split off on the way are dropped along with their keys.
+    void insert_batch(Node *node, T *first, T *last, std::vector<Split> &splits) {
+        if (node->is_leaf_node()) {
+            auto const count = static_cast<size_t>(last - first);
+            size_t const key_num = node->key_num_;
+            if (key_num + count <= max_keys) {
+                std::uninitialized_move(first, last, node->keys_ + key_num);
+                node->key_num_ += count;
+                std::inplace_merge(node->keys_, node->keys_ + key_num, node->keys_ + node->key_num_, key_less());
+                return;
+            }
+            std::vector<T> keys;
+            keys.reserve(key_num + count);
+            std::vector<Node *> siblings = make_siblings(node, key_num + count, splits);
+            try {
+                std::merge(take_keys(node->keys_), take_keys(node->keys_ + key_num), std::make_move_iterator(first),
+                           std::make_move_iterator(last), std::back_inserter(keys), key_less());
+            } catch (...) {
+                for (Node *sibling: siblings) nodes_.free(sibling);
+                throw;
+            }
+            distribute(node, keys, nullptr, siblings, splits);
+            return;
+        }
+
+        InternalNode *const internal = node->as_internal();
+        size_t const key_num = node->key_num_;
+        // Splits of the children, each with the index of the child.
+        std::vector<std::pair<size_t, Split>> child_splits;
+        std::vector<Split> splits_of_child;
+        std::vector<T> keys;
+        std::vector<Node *> children;
+        std::vector<Node *> siblings;
+        try {
+            while (first != last) {
+                size_t const i = find_index(node, *first);
+                T *part_end = i == key_num ? last : std::partition_point(first, last, [&](T const &value) {
+                    return !less(node->keys_[i], value);
+                });
+                insert_batch(internal->own_child(i, nodes_), first, part_end, splits_of_child);
+                if constexpr (counted) internal->counts_[i] += part_end - first;
+                for (auto &split: splits_of_child) {
+                    child_splits.emplace_back(i, std::move(split));
+                }
+                splits_of_child.clear();
+                first = part_end;
+            }
+            if (child_splits.empty()) return;
+
+            keys.reserve(key_num + child_splits.size());
+            children.reserve(key_num + child_splits.size() + 1);
+            siblings = make_siblings(node, key_num + child_splits.size(), splits);
+            auto split = child_splits.begin();
+            for (size_t i = 0; i <= key_num; ++i) {
+                children.push_back(internal->children_[i]);
+                for (; split != child_splits.end() && split->first == i; ++split) {
+                    keys.push_back(std::move(split->second.separator));
+                    children.push_back(split->second.node);
+                }
+                if (i != key_num) keys.push_back(*take_keys(node->keys_ + i));
+            }
+        } catch (...) {
+            for (auto &[index, split]: child_splits) nodes_.destroy(split.node);
+            for (auto &split: splits_of_child) nodes_.destroy(split.node);
+            for (Node *sibling: siblings) nodes_.free(sibling);
+            throw;
+        }
+        distribute(node, keys, children.data(), siblings, splits);
+    }
+
+    // Puts a new root over the root and the nodes split off it. What does
+    // not fit into the new root is left in splits.
+    InternalNode *grow_root(std::vector<Split> &splits) {
+        InternalNode *new_root = nullptr;
+        std::vector<T> keys;
+        std::vector<Node *> children;
+        std::vector<Node *> siblings;
+        std::vector<Split> more;
+        try {
+            new_root = nodes_.make_internal(root_->level_ + 1);
+            keys.reserve(splits.size());
+            children.reserve(splits.size() + 1);
+            siblings = make_siblings(new_root, splits.size(), more);
+        } catch (...) {
+            for (auto &split: splits) nodes_.destroy(split.node);
+            if (new_root != nullptr) nodes_.free(new_root);
+            throw;
+        }
+        children.push_back(root_);
+        for (auto &split: splits) {
+            keys.push_back(std::move(split.separator));
+            children.push_back(split.node);
+        }
+        distribute(new_root, keys, children.data(), siblings, more);
+        splits = std::move(more);
+        return new_root;
+    }
+
+    // The new siblings it takes to spread keys over node and them, with
+    // room for them in splits. This is all the allocating there is to
+    // distribute, done before the keys to spread are taken out of node.
+    std::vector<Node *> make_siblings(Node const *node, size_t keys, std::vector<Split> &splits) {
+        size_t const width = (keys + max_children) / max_children;
+        std::vector<Node *> siblings;
+        siblings.reserve(width - 1);
+        splits.reserve(splits.size() + width - 1);
+        try {
+            while (siblings.size() < width - 1) {
+                siblings.push_back(nodes_.make_sibling(node));
+            }
+        } catch (...) {
+            for (Node *sibling: siblings) nodes_.free(sibling);
+            throw;
+        }
+        return siblings;
+    }
+
+    // Spreads keys, along with children for internal nodes, evenly over
+    // node and its new siblings, and adds the siblings to splits. Like
+    // relocate, this counts on moving keys not to throw.
+    void distribute(Node *node, std::vector<T> &keys, Node *const *children, std::vector<Node *> const &siblings,
+                    std::vector<Split> &splits) noexcept {
+        size_t const items = keys.size() + 1;
+        size_t const width = siblings.size() + 1;
+        assert(width == (items + max_children - 1) / max_children);
+        std::destroy_n(node->keys_, node->key_num_);
+        node->key_num_ = 0;
+        size_t const share = items / width;
+        size_t const extra = items % width;
+        size_t key = 0;
+        for (size_t j = 0; j < width; ++j) {
+            Node *piece = node;
+            if (j != 0) {
+                piece = siblings[j - 1];
+                splits.push_back({std::move(keys[key++]), piece});
+            }
+            size_t const count = share + (j < extra) - 1;
+            if (children != nullptr) {
+                InternalNode *internal = piece->as_internal();
+                std::copy_n(children + key, count + 1, internal->children_);
+                if constexpr (counted) {
+                    for (size_t i = 0; i <= count; ++i) {
+                        internal->counts_[i] = InternalNode::subtree_size(internal->children_[i]);
+                    }
+                }
+            }
+            std::uninitialized_move_n(keys.begin() + key, count, piece->keys_);
+            piece->key_num_ = count;
+            key += count;
+        }
+    }
+
+    // Keys that leave a node only to come back in a different order are
+    // moved out when nothing can throw before they are back, and copied
+    // otherwise, so that a throw leaves the node as it was. Keys that
+    // cannot be copied are always moved.
+    static constexpr bool move_out_keys = !std::copy_constructible<T>
+            || std::is_nothrow_move_constructible_v<T>
+               && noexcept(std::declval<Comparator const &>()(std::declval<T const &>(), std::declval<T const &>()));
+
+    static auto take_keys(T *keys) noexcept {
+        if constexpr (move_out_keys) return std::make_move_iterator(keys);
+        else return static_cast<T const *>(keys);
+    }
+
+    // Removes one key for each of the sorted values [first, last) from the
+    // subtree of node, adding the number of removed keys to erased. Keeps
+    // the subtree valid except that node itself, and the only child of
+    // node if node is left without keys, may end up underfull. Returns how
+    // many of the values equal to the last one were not found.
+    size_t erase_batch(Node *node, T const *first, T const *last, size_t &erased) {
+        if (first == last) return 0;
+        T const &back = last[-1];
+        size_t not_found = 0;
+        if (node->is_leaf_node()) {
+            size_t kept = 0;
+            for (size_t i = 0; i < node->key_num_; ++i) {
+                while (first != last && less(*first, node->keys_[i])) {
+                    not_found += equals(*first++, back);
+                }
+                if (first != last && !less(node->keys_[i], *first)) {
+                    std::destroy_at(node->keys_ + i);
+                    ++first;
+                    ++erased;
+                } else {
+                    if (kept != i) Node::relocate(node->keys_ + kept, node->keys_ + i, 1);
+                    ++kept;
+                }
+            }
+            node->key_num_ = kept;
+            for (; first != last; ++first) {
+                not_found += equals(*first, back);
+            }
+            return not_found;
+        }
+
+        InternalNode *const internal = node->as_internal();
+        size_t const key_num = node->key_num_;
+        bool removed[max_keys]{};
+        // Values equal to a key that was not found left of it are looked for
+        // right of it, they are the last ones of the left part.
+        size_t carried = 0;
+        for (size_t i = find_index(node, *first);; i = carried != 0 ? i + 1 : find_index(node, *first)) {
+            T const *part_end = i == key_num ? last : std::partition_point(first, last, [&](T const &value) {
+                return !less(node->keys_[i], value);
+            });
+            [[maybe_unused]] size_t const erased_before = erased;
+            not_found = erase_batch(internal->own_child(i, nodes_), first - carried, part_end, erased);
+            if constexpr (counted) internal->counts_[i] -= erased - erased_before;
+            carried = 0;
+            if (i != key_num && not_found != 0 && equals(part_end[-1], node->keys_[i])) {
+                removed[i] = true;
+                ++erased;
+                carried = not_found = not_found - 1;
+            }
+            first = part_end;
+            if (i == key_num || (first == last && carried == 0)) break;
+        }
+
+        for (size_t i = key_num; i-- > 0;) {
+            if (removed[i]) fill_hole(internal, i);
+        }
+        fix_children(internal);
+        return not_found;
+    }
+
+    // Refills the key at index, which is no longer in the tree but still
+    // alive, with a neighbouring key, or drops it along with the child
+    // right of it if there are none.
+    void fill_hole(InternalNode *node, size_t index) {
+        Node *const left = node->children_[index];
+        Node *const right = node->children_[index + 1];
+        if (!is_empty(left)) {
+            node->keys_[index] = pop_max(node->own_child(index, nodes_));
+            if constexpr (counted) --node->counts_[index];
+        } else if (!is_empty(right)) {
+            node->keys_[index] = pop_min(node->own_child(index + 1, nodes_));
+            if constexpr (counted) --node->counts_[index + 1];
+        } else {
+            std::destroy_at(node->keys_ + index);
+            InternalNode::move_children(node, index + 1, node, index + 2, node->key_num_ - index - 1);
+            node->close_gap(index);
+            nodes_.destroy(right);
+        }
+    }
+
+    using iter_info = typename const_iterator::iter_info;
+
+    void erase_between(const_iterator const &first, const_iterator const &last) {
+        own_root();
+        size_ -= erase_range(root_, first.path_, first.path_ + first.depth_,
+                             last.depth_ != 0 ? last.path_ : nullptr, last.path_ + last.depth_);
+        drop_empty_roots();
+    }
+
+    // The position of the key at it in iteration order.
+    [[nodiscard]] static size_t index_of(const_iterator const &it) noexcept requires counted {
+        size_t index = 0;
+        for (size_t depth = 0; depth < it.depth_; ++depth) {
+            auto const [node, key_index] = it.path_[depth];
+            index += key_index + InternalNode::count_children(node, 0, key_index + (depth + 1 == it.depth_));
+        }
+        return index;
+    }
+
+    // Removes the keys from the one at the path [first, first_end) on,
+    // up to the one at the path [last, last_end), from the subtree of
+    // node, where the paths start at node's level; no first means from
+    // the start of the subtree and no last up to its end. Returns how many
+    // keys it removed. The children entirely in between are dropped
+    // without visiting them, so that only the subtrees the paths go
+    // through get rebalanced, which leaves them as erase_batch does.
+    size_t erase_range(Node *node, iter_info const *first, iter_info const *first_end,
+                       iter_info const *last, iter_info const *last_end) {
+        size_t const key_num = node->key_num_;
+        size_t const first_key = first != nullptr ? first->key_index : 0;
+        size_t const last_key = last != nullptr ? last->key_index : key_num;
+        if (node->is_leaf_node()) {
+            // A range ending at the first key of a leaf removes nothing
+            // from it, and keys are not to be moved onto themselves.
+            std::destroy(node->keys_ + first_key, node->keys_ + last_key);
+            if (first_key != last_key) {
+                Node::relocate(node->keys_ + first_key, node->keys_ + last_key, key_num - last_key);
+            }
+            node->key_num_ = key_num - (last_key - first_key);
+            return last_key - first_key;
+        }
+
+        InternalNode *const internal = node->as_internal();
+        bool const first_inside = first != nullptr && first + 1 != first_end;
+        bool const last_inside = last != nullptr && last + 1 != last_end;
+        size_t erased = last_key - first_key;
+        if (first_inside) {
+            bool const both = last_inside && last_key == first_key;
+            size_t const child_erased = erase_range(internal->own_child(first_key, nodes_), first + 1, first_end,
+                                                    both ? last + 1 : nullptr, last_end);
+            if constexpr (counted) internal->counts_[first_key] -= child_erased;
+            erased += child_erased;
+            if (both) {
+                fix_children(internal);
+                return erased;
+            }
+        }
+        if (last_inside) {
+            size_t const child_erased = erase_range(internal->own_child(last_key, nodes_), nullptr, nullptr,
+                                                    last + 1, last_end);
+            if constexpr (counted) internal->counts_[last_key] -= child_erased;
+            erased += child_erased;
+        }
+
+        // The children entirely in range. There may be one more of them
+        // than of keys, if the range starts before a child and ends at a
+        // key, and then the last of them only gets emptied, or one less,
+        // if the range goes into a child at both ends, and then the first
+        // key is kept to be refilled.
+        size_t const drop_begin = first != nullptr ? first_key + 1 : 0;
+        size_t drop_end = last_inside ? last_key : last_key + 1;
+        bool const hole = drop_end - drop_begin < last_key - first_key;
+        if (drop_end - drop_begin > last_key - first_key) {
+            --drop_end;
+            size_t const child_erased = erase_range(internal->own_child(drop_end, nodes_), nullptr, nullptr,
+                                                    nullptr, nullptr);
+            if constexpr (counted) internal->counts_[drop_end] -= child_erased;
+            erased += child_erased;
+        }
+        for (size_t i = drop_begin; i < drop_end; ++i) {
+            if constexpr (counted) erased += internal->counts_[i];
+            else erased += count_keys(internal->children_[i]);
+            nodes_.destroy(internal->children_[i]);
+        }
+        std::destroy(node->keys_ + first_key + hole, node->keys_ + last_key);
+        if (first_key + hole != last_key) {
+            Node::relocate(node->keys_ + first_key + hole, node->keys_ + last_key, key_num - last_key);
+        }
+        InternalNode::move_children(internal, drop_begin, internal, drop_end, key_num + 1 - drop_end);
+        node->key_num_ = key_num - (last_key - first_key) + hole;
+        if (hole) fill_hole(internal, first_key);
+        fix_children(internal);
+        return erased;
+    }
+
+    [[nodiscard]] static size_t count_keys(Node const *node) noexcept {
+        size_t keys = node->key_num_;
+        if (node->is_internal_node()) {
+            for (size_t i = 0; i <= node->key_num_; ++i) {
+                keys += count_keys(node->child(i));
+            }
+        }
+        return keys;
+    }
+
+    // Counts the keys of a subtree like count_keys, unless that takes
+    // visiting more than budget nodes.
+    [[nodiscard]] static std::optional<size_t> count_keys(Node const *node, size_t &budget) noexcept {
+        if (node == nullptr) return 0;
+        if (budget-- == 0) return std::nullopt;
+        size_t keys = node->key_num_;
+        if (node->is_internal_node()) {
+            for (size_t i = 0; i <= node->key_num_; ++i) {
+                auto const child_keys = count_keys(node->child(i), budget);
+                if (!child_keys) return std::nullopt;
+                keys += *child_keys;
+            }
+        }
+        return keys;
+    }
+
+    // The sizes of two subtrees with size keys between them, found by
+    // counting the smaller one.
+    [[nodiscard]] static std::pair<size_t, size_t> count_apart(Node const *left, Node const *right,
+                                                               size_t size) noexcept {
+        for (size_t budget = 64;; budget *= 2) {
+            size_t left_budget = budget;
+            if (auto const keys = count_keys(left, left_budget)) return {*keys, size - *keys};
+            size_t right_budget = budget;
+            if (auto const keys = count_keys(right, right_budget)) return {size - *keys, *keys};
+        }
+    }
+
+    // A subtree cut off a tree or about to join one, whose root may be
+    // underfull but has keys, with its number of keys if the tree is
+    // counted. No root makes an empty one.
+    struct Part {
+        Node *root;
+        size_t size;
+    };
+
+    // Cuts the subtree of node into the keys less than key and the rest.
+    // The pieces of the nodes on the way down get joined with the parts of
+    // the child below them, so every level costs O(1) plus the difference
+    // in height of what gets joined there, which adds up to O(log N). If
+    // anything throws on the way, the subtree is freed whole: by then it
+    // is in pieces that no longer make a tree.
+    template<typename K>
+    std::pair<Part, Part> split_node(Node *node, K const &key) {
+        size_t const key_num = node->key_num_;
+        size_t index;
+        // The node's upper piece, unless the node keeps it or has none.
+        Node *piece = nullptr;
+        try {
+            index = find_index(node, key);
+            if (index != 0 && index != key_num) piece = nodes_.make_sibling(node);
+            if (node->is_internal_node()) node->as_internal()->own_child(index, nodes_);
+        } catch (...) {
+            if (piece != nullptr) nodes_.free(piece);
+            nodes_.destroy(node);
+            throw;
+        }
+        if (node->is_leaf_node()) {
+            if (index == 0) return {{nullptr, 0}, {node, key_num}};
+            if (index == key_num) return {{node, key_num}, {nullptr, 0}};
+            Node::relocate(piece->keys_, node->keys_ + index, key_num - index);
+            piece->key_num_ = key_num - index;
+            node->key_num_ = index;
+            return {{node, index}, {piece, key_num - index}};
+        }
+
+        InternalNode *const internal = node->as_internal();
+        Part lower{nullptr, 0};
+        Part upper{nullptr, 0};
+        try {
+            std::tie(lower, upper) = split_node(internal->children_[index], key);
+        } catch (...) {
+            // The child at index is gone already.
+            if (piece != nullptr) nodes_.free(piece);
+            for (size_t i = 0; i <= key_num; ++i) {
+                if (i != index) nodes_.destroy(internal->children_[i]);
+            }
+            nodes_.free(internal);
+            throw;
+        }
+        // The node's own pieces: children [0, index) with the keys between
+        // them on the left, children (index, key_num] on the right, and
+        // the keys around the child that got split to join them with its
+        // parts.
+        std::optional<T> lower_separator;
+        std::optional<T> upper_separator;
+        Part lower_piece{nullptr, 0};
+        Part upper_piece{nullptr, 0};
+        if (index != key_num) {
+            upper_separator.emplace(std::move(node->keys_[index]));
+            std::destroy_at(node->keys_ + index);
+            InternalNode *upper_node = internal;
+            if (index != 0) {
+                upper_node = piece->as_internal();
+                Node::relocate(upper_node->keys_, node->keys_ + index + 1, key_num - index - 1);
+                InternalNode::move_children(upper_node, 0, internal, index + 1, key_num - index);
+            } else {
+                Node::relocate(upper_node->keys_, node->keys_ + 1, key_num - 1);
+                InternalNode::move_children(upper_node, 0, internal, 1, key_num);
+            }
+            upper_node->key_num_ = key_num - index - 1;
+            upper_piece = take_piece(upper_node);
+        }
+        if (index != 0) {
+            lower_separator.emplace(std::move(node->keys_[index - 1]));
+            std::destroy_at(node->keys_ + index - 1);
+            node->key_num_ = index - 1;
+            lower_piece = take_piece(internal);
+        }
+        try {
+            if (lower_piece.root != nullptr) {
+                lower = join_parts(lower_piece, std::move(*lower_separator), lower);
+                lower_piece.root = nullptr;
+            }
+            if (upper_piece.root != nullptr) upper = join_parts(upper, std::move(*upper_separator), upper_piece);
+        } catch (...) {
+            destroy_parts({lower_piece, lower, upper, upper_piece});
+            throw;
+        }
+        return {lower, upper};
+    }
+
+    // Frees the nodes of the parts of a tree that was being cut up or
+    // joined when something threw.
+    void destroy_parts(std::initializer_list<Part> parts) noexcept {
+        for (Part const &part: parts) {
+            if (part.root != nullptr) nodes_.destroy(part.root);
+        }
+    }
+
+    // A piece of an internal node as a Part, which is its only child if it
+    // is left without keys.
+    Part take_piece(InternalNode *piece) noexcept {
+        Part part{piece, 0};
+        if constexpr (counted) {
+            part.size = piece->key_num_ + InternalNode::count_children(piece, 0, piece->key_num_ + 1);
+        }
+        if (piece->key_num_ == 0) {
+            part.root = piece->children_[0];
+            nodes_.free(piece);
+        }
+        return part;
+    }
+
+    // Joins the parts left and right with separator between them. The
+    // shorter part, or the separator alone if it is empty, goes at the
+    // edge of the taller one facing it, at its own level, on the way down
+    // to which full nodes get split like for an insert. That takes O(1 +
+    // the difference in height). If it throws, left and right still hold
+    // all the nodes between them, one of them maybe none, for the caller
+    // to free.
+    Part join_parts(Part &left, T &&separator, Part &right) {
+        size_t const size = left.size + 1 + right.size;
+        if (left.root != nullptr && right.root != nullptr && left.root->level_ == right.root->level_) {
+            InternalNode *root = nodes_.make_internal(left.root->level_ + 1);
+            std::construct_at(root->keys_, std::move(separator));
+            root->key_num_ = 1;
+            root->set_child(0, left.root, left.size);
+            root->set_child(1, right.root, right.size);
+            left.root = root;
+            right.root = nullptr;
+            fix_children(root);
+            return {drop_empty_root(root), size};
+        }
+
+        bool const into_left = right.root == nullptr
+                               || (left.root != nullptr && left.root->level_ > right.root->level_);
+        Part &tall = into_left ? left : right;
+        Part &low = into_left ? right : left;
+        if constexpr (copy_on_write) tall.root = nodes_.own(tall.root);
+        if (tall.root->is_full()) {
+            InternalNode *new_root = nodes_.make_internal(tall.root->level_ + 1);
+            new_root->set_child(0, tall.root, tall.size);
+            tall.root = new_root;
+            new_root->split_child_right(0, nodes_);
+        }
+
+        size_t const level = low.root != nullptr ? low.root->level_ + 1 : 0;
+        Path path;
+        Node *node = tall.root;
+        while (node->level_ != level) {
+            InternalNode *const internal = node->as_internal();
+            size_t index = into_left ? node->key_num_ : 0;
+            if (internal->children_[index]->is_full()) {
+                internal->split_child_right(index, nodes_);
+                if (into_left) ++index;
+            }
+            path.push(internal, index);
+            node = internal->own_child(index, nodes_);
+        }
+        path.add(static_cast<ptrdiff_t>(1 + low.size));
+        size_t const index = into_left ? node->key_num_ : 0;
+        if (low.root == nullptr) {
+            node->insert_key(index, std::move(separator));
+            return {tall.root, size};
+        }
+        InternalNode *const internal = node->as_internal();
+        if (!into_left) InternalNode::move_children(internal, 1, internal, 0, node->key_num_ + 1);
+        node->insert_key(index, std::move(separator));
+        internal->set_child(into_left ? index + 1 : 0, low.root, low.size);
+        bool const underfull = low.root->key_num_ < min_keys;
+        low.root = nullptr;
+        if (underfull) fix_child(internal, index);
+        return {tall.root, size};
+    }
+
+    // Merging the children of a root may leave it without keys.
+    Node *drop_empty_root(InternalNode *root) noexcept {
+        if (root->key_num_ != 0) return root;
+        Node *child = root->children_[0];
+        nodes_.free(root);
+        return child;
+    }
+
+    // A subtree that lost all its keys may still be a chain of internal
+    // nodes left with a single child each.
+    [[nodiscard]] static bool is_empty(Node const *node) noexcept {
+        while (node->key_num_ == 0 && node->is_internal_node()) {
+            node = node->child(0);
+        }
+        return node->key_num_ == 0;
+    }
+
+    // Removes and returns the greatest key of a nonempty subtree.
+    T pop_max(Node *node) {
+        if (node->is_leaf_node()) {
+            T value = std::move(node->keys_[node->key_num_ - 1]);
+            node->remove_leaf(node->key_num_ - 1);
+            return value;
+        }
+        size_t const index = node->key_num_;
+        T value = pop_max(node->as_internal()->own_child(index, nodes_));
+        if constexpr (counted) --node->as_internal()->counts_[index];
+        if (index != 0 && node->child(index)->key_num_ < min_keys) fix_child(node->as_internal(), index);
+        return value;
+    }
+
+    // Removes and returns the least key of a nonempty subtree.
+    T pop_min(Node *node) {
+        if (node->is_leaf_node()) {
+            T value = std::move(node->keys_[0]);
+            node->remove_leaf(0);
+            return value;
+        }
+        T value = pop_min(node->as_internal()->own_child(0, nodes_));
+        if constexpr (counted) --node->as_internal()->counts_[0];
+        if (node->key_num_ != 0 && node->child(0)->key_num_ < min_keys) fix_child(node->as_internal(), 0);
+        return value;
+    }
+
+    // Brings every child of node up to the minimum occupancy by merging
+    // or balancing it with a neighbour, as long as node has keys to do it
+    // with. Children moved around on the way get fixed as well, in case
+    // an underfull child came along.
+    void fix_children(InternalNode *node) noexcept {
+        for (size_t i = 0; i <= node->key_num_ && node->key_num_ != 0;) {
+            if (node->children_[i]->key_num_ < min_keys) i = fix_child(node, i);
+            else ++i;
+        }
+    }
+
+    // Fixes the underfull child at index, returns the index to recheck.
+    size_t fix_child(InternalNode *node, size_t index) noexcept {
+        assert(node->key_num_ != 0);
+        index = std::min(index, node->key_num_ - 1);
+        size_t const left_num = node->children_[index]->key_num_;
+        size_t const keys = left_num + node->children_[index + 1]->key_num_ + 1;
+        if (keys <= max_keys) {
+            node->merge_child_with_right(index, nodes_);
+            Node *const merged = node->children_[index];
+            if (merged->is_internal_node()) fix_children(merged->as_internal());
+            return index;
+        }
+        size_t const left_keys = (keys - 1) / 2;
+        if (left_num < left_keys) node->take_from_right(index, nodes_, left_keys - left_num);
+        else if (left_num > left_keys) node->take_from_left(index + 1, nodes_, left_num - left_keys);
+        if (node->children_[index]->is_internal_node()) {
+            // Which may merge some of their children and leave them short
+            // of keys again.
+            fix_children(node->own_child(index, nodes_)->as_internal());
+            fix_children(node->own_child(index + 1, nodes_)->as_internal());
+        }
+        return index;
+    }
+
+    template<typename U>
+    void insert_value(U &&value) {
+        // Keys greater than all others, such as timestamps, go down the
+        // right edge of the tree with one comparison per node.
+        insert_value(std::forward<U>(value), [&](Node const *node, size_t, bool right_edge) {
+            if (right_edge && less(node->keys_[node->key_num_ - 1], value)) return node->key_num_;
+            return find_index(node, value);
+        });
+    }
+
+    // Goes down to where locate(node, depth, right_edge) says value goes
+    // in each node, splitting the full nodes on the way, and inserts it
+    // there. depth counts from the root as it was, and right_edge tells
+    // whether node is the last at its level. Returns the iterator to
+    // value.
+    template<typename U, typename Locate>
+    const_iterator insert_value(U &&value, Locate const &locate) {
+        const_iterator it = end();
+        if (root_ == nullptr) {
+            Node *root = nodes_.make_leaf();
+            try {
+                root->insert_key(0, std::forward<U>(value));
+            } catch (...) {
+                nodes_.free(root);
+                throw;
+            }
+            root_ = root;
+            size_ = 1;
+            it.push(root_, 0);
+            return it;
+        }
+
+        own_root();
+        Node *node = root_;
+        size_t index = 0;
+        size_t depth = 0;
+        if (root_->is_full()) {
+            InternalNode *new_root = nodes_.make_internal(root_->level_ + 1);
+            new_root->set_child(0, root_, size_);
+            root_ = node = new_root;
+        } else {
+            index = locate(node, depth++, true);
+        }
+
+        Path path;
+        bool right_edge = true;
+        try {
+            while (node->is_internal_node()) {
+                InternalNode *const internal = node->as_internal();
+                Node const *const child = internal->children_[index];
+                size_t child_index = locate(child, depth++, right_edge && index == node->key_num_);
+                if (child->is_full()) {
+                    Node const *const left = index != 0 ? internal->children_[index - 1] : nullptr;
+                    if (right_edge && index == node->key_num_ && child_index == max_keys
+                        && left != nullptr && !left->is_full()) {
+                        // Appending: topping up the left neighbour makes room
+                        // just as well, and splitting would leave it half empty
+                        // for good.
+                        size_t const count = max_keys - left->key_num_;
+                        internal->take_from_right(index - 1, nodes_, count);
+                        child_index -= count;
+                    } else {
+                        internal->split_child_right(index, nodes_);
+                        if (child_index > max_keys / 2) {
+                            child_index -= max_keys / 2 + 1;
+                            ++index;
+                        }
+                    }
+                }
+                right_edge = right_edge && index == node->key_num_;
+                it.push(node, index);
+                path.push(internal, index);
+                node = internal->own_child(index, nodes_);
+                index = child_index;
+            }
+            node->insert_key(index, std::forward<U>(value));
+        } catch (...) {
+            // The new root, if splitting the old one failed.
+            drop_empty_roots();
+            throw;
+        }
+        it.push(node, index);
+        path.add(1);
+        ++size_;
+        return it;
+    }
+
+    // Follows the path of hint, and below its end the last child of each
+    // node, which leads to right before hint.
+    template<typename U>
+    const_iterator insert_hinted(const_iterator const &hint, U &&value) {
+        if (root_ != nullptr && ((hint != end() && less(*hint, value))
+                                 || (!hint.at_first() && less(value, *std::prev(hint))))) {
+            return insert_hinted(lower_bound(value), std::forward<U>(value));
+        }
+        return insert_value(std::forward<U>(value), [&](Node const *node, size_t depth, bool) {
+            return depth < hint.depth_ ? hint.path_[depth].key_index : node->key_num_;
+        });
+    }
+
+    // Removing keys in bulk may leave roots without keys on top.
+    void drop_empty_roots() noexcept {
+        while (root_ != nullptr && root_->key_num_ == 0) {
+            Node *old_root = root_;
+            root_ = old_root->child_below(0);
+            nodes_.free(old_root);
+        }
+    }
+
+    // Makes the root this tree's own before changing anything.
+    void own_root() {
+        if constexpr (copy_on_write) root_ = nodes_.own(root_);
+    }
+
+    // See default_policy::prefetch_keys.
+    void prefetch_keys([[maybe_unused]] Node const *node) const noexcept {
+        if constexpr (Policy::prefetch_keys) {
+            size_t const bytes = node->key_num_ * sizeof(T);
+            if (bytes > 64 && size_ >= Policy::prefetch_min_bytes / sizeof(T)) detail::prefetch(node->keys_, bytes);
+        }
+    }
+
+    template<typename K>
+    size_t find_index(Node const *node, K const &value) const noexcept(
+    noexcept(std::declval<Comparator>()(std::declval<T>(), std::declval<K>()))
     ) {
         // Returns index of the first occurrence of value or of the first
         // element greater than it
         // 2: 0 1 ->3<- 3 4 5
         // 2: 0 1 ->2<- 2 3 5
+        prefetch_keys(node);
+#ifdef B_TREE_AVX2_SEARCH
+        if constexpr (std::same_as<K, T> && detail::vector_searchable<T, Comparator>) {
+            if (detail::cpu_has_avx2) return detail::vector_search<false>(node->keys_, node->key_num_, value);
+        }
+#endif
         T const *left = node->keys_;
         T const *right = left + node->key_num_;
         while (right != left) {
             T const *mid = left + (right - left) / 2;
-            if (comparator_(*mid, value)) left = mid + 1;
+            if (less(*mid, value)) left = mid + 1;
             else right = mid;
         }
         return left - node->keys_;
     }
 
-    bool equals(T const &a, T const &b) const noexcept(
-    noexcept(std::declval<Comparator>()(std::declval<T>(), std::declval<T>()))
+    // Like find_index, but skips the keys equal to value as well.
+    template<typename K>
+    size_t find_upper_index(Node const *node, K const &value) const noexcept(
+    noexcept(std::declval<Comparator>()(std::declval<T>(), std::declval<K>()))
+    ) {
+        prefetch_keys(node);
+#ifdef B_TREE_AVX2_SEARCH
+        if constexpr (std::same_as<K, T> && detail::vector_searchable<T, Comparator>) {
+            if (detail::cpu_has_avx2) return detail::vector_search<true>(node->keys_, node->key_num_, value);
+        }
+#endif
+        T const *left = node->keys_;
+        T const *right = left + node->key_num_;
+        while (right != left) {
+            T const *mid = left + (right - left) / 2;
+            if (less(value, *mid)) right = mid;
+            else left = mid + 1;
+        }
+        return left - node->keys_;
+    }
+
+    struct Slot {
+        size_t index;
+        bool found;
+    };
+
+    // find_index, along with whether the key there equals value. With a
+    // three-way comparison the search tells that itself, since the key at
+    // the final index is always the last one it probed.
+    template<typename K>
+    Slot find_slot(Node const *node, K const &value) const noexcept(
+    noexcept(std::declval<Comparator>()(std::declval<T>(), std::declval<K>()))
+    ) {
+        if constexpr (!three_way_with<K> || (std::same_as<K, T> && detail::vector_searchable<T, Comparator>)) {
+            size_t const index = find_index(node, value);
+            return {index, index != node->key_num_ && !less(value, node->keys_[index])};
+        } else {
+            prefetch_keys(node);
+            T const *left = node->keys_;
+            T const *right = left + node->key_num_;
+            bool found = false;
+            while (right != left) {
+                T const *mid = left + (right - left) / 2;
+                auto const order = compare(*mid, value);
+                if (order < 0) {
+                    left = mid + 1;
+                } else {
+                    right = mid;
+                    found = order == 0;
+                }
+            }
+            return {static_cast<size_t>(left - node->keys_), found};
+        }
+    }
+
+    template<typename A, typename B>
+    bool less(A const &a, B const &b) const noexcept(
+    noexcept(std::declval<Comparator>()(std::declval<A>(), std::declval<B>()))
+    ) {
+        if constexpr (three_way_comparator) return comparator_(a, b) < 0;
+        else return comparator_(a, b);
+    }
+
+    template<typename K>
+    auto compare(T const &a, K const &b) const noexcept(
+    noexcept(std::declval<Comparator>()(std::declval<T>(), std::declval<K>()))
+    ) requires three_way_with<K> {
+        if constexpr (three_way_comparator) return comparator_(a, b);
+        else return std::compare_three_way()(a, b);
+    }
+
+    // less as a predicate for the standard algorithms.
+    auto key_less() const noexcept {
+        return [this](T const &a, T const &b) { return less(a, b); };
+    }
+
+    template<typename K>
+    bool equals(T const &a, K const &b) const noexcept(
+    noexcept(std::declval<Comparator>()(std::declval<T>(), std::declval<K>()))
     ) {
-        // account for different comparators
-        return comparator_(a, b) == comparator_(b, a);
+        if constexpr (three_way_with<K>) return compare(a, b) == 0;
+        else return !less(a, b) && !less(b, a);
     }
 };
 
-template<std::copyable T, size_t Order, typename Comparator>
-void swap(BTree<T, Order, Comparator> bTree1, BTree<T, Order, Comparator> bTree2) {
+template<std::movable T, size_t Order, typename Comparator, typename Allocator, typename Policy>
+void swap(BTree<T, Order, Comparator, Allocator, Policy> bTree1, BTree<T, Order, Comparator, Allocator, Policy> bTree2) {
     bTree1.swap(bTree2);
 }
 
@@ -0,0 +1,875 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "key_search.h"
+#include "node_keys.h"
+
+namespace b_tree {
+
+// A map with unique keys, laid out like BPlusTree: values only live in the
+// leaves, which are linked in key order, and internal nodes hold copies of
+// keys to separate their children. Each leaf keeps its values in an array
+// of their own next to the key array, so searching a node never loads the
+// cache lines of the values.
+template<std::copyable Key, std::movable Value, size_t Order, typename Comparator = std::less<>,
+        typename Allocator = std::allocator<std::pair<Key const, Value>>>
+class BTreeMap {
+    static_assert(Order > 1, "Order must be greater than 1");
+
+    static constexpr size_t max_children = Order * 2;
+    static constexpr size_t max_keys = max_children - 1;
+    static constexpr size_t min_children = Order;
+    static constexpr size_t min_keys = min_children - 1;
+
+    static_assert(min_keys != 0);
+
+    // See BTree::max_height.
+    static constexpr size_t max_height = [] {
+        size_t height = 2;
+        for (size_t nodes = 2; nodes < SIZE_MAX / min_children; nodes *= min_children) {
+            ++height;
+        }
+        return height;
+    }();
+
+    struct Leaf;
+    struct InternalNode;
+    class NodeFactory;
+
+    // See BTree::lookup_key.
+    template<typename K>
+    static constexpr bool lookup_key = std::same_as<K, Key> || requires { typename Comparator::is_transparent; };
+
+    // Separator i of an internal node is greater than the keys under child
+    // i and no greater than those under child i + 1.
+    struct Node : detail::NodeKeys<Key, max_keys> {
+    private:
+        Node() noexcept = default;  // a leaf
+
+        [[nodiscard]] Leaf *as_leaf() noexcept {
+            assert(this->is_leaf_node());
+            return static_cast<Leaf *>(this);
+        }
+
+        [[nodiscard]] InternalNode *as_internal() noexcept {
+            assert(this->is_internal_node());
+            return static_cast<InternalNode *>(this);
+        }
+
+        [[nodiscard]] Node *child(size_t index) const noexcept {
+            return static_cast<InternalNode const *>(this)->children_[index];
+        }
+
+        friend class BTreeMap;
+        friend struct Leaf;
+        friend struct InternalNode;
+        friend class NodeFactory;
+    };
+
+    // values_[i] belongs to keys_[i], the first key_num_ of both are alive.
+    struct Leaf : Node {
+    private:
+        Leaf() noexcept {}
+
+        ~Leaf() {
+            std::destroy_n(values_, this->key_num_);
+        }
+
+        template<typename K, typename... Args>
+        void emplace(size_t index, K &&key, Args &&... args) {
+            this->insert_key(index, std::forward<K>(key));
+            size_t const moved = this->key_num_ - 1 - index;
+            detail::relocate(values_ + index + 1, values_ + index, moved);
+            try {
+                std::construct_at(values_ + index, std::forward<Args>(args)...);
+            } catch (...) {
+                detail::relocate(values_ + index, values_ + index + 1, moved);
+                this->remove_key(index);
+                throw;
+            }
+        }
+
+        void erase(size_t index) noexcept {
+            std::destroy_at(values_ + index);
+            detail::relocate(values_ + index, values_ + index + 1, this->key_num_ - index - 1);
+            this->remove_key(index);
+        }
+
+        // Relocates count entries, the key counts are up to the caller.
+        static void move_entries(Leaf *to, size_t to_index, Leaf *from, size_t from_index, size_t count) noexcept {
+            Node::relocate(to->keys_ + to_index, from->keys_ + from_index, count);
+            detail::relocate(to->values_ + to_index, from->values_ + from_index, count);
+        }
+
+        void copy_entries(Leaf const *other) {
+            for (; this->key_num_ < other->key_num_; ++this->key_num_) {
+                size_t const i = this->key_num_;
+                std::construct_at(this->keys_ + i, other->keys_[i]);
+                try {
+                    std::construct_at(values_ + i, other->values_[i]);
+                } catch (...) {
+                    std::destroy_at(this->keys_ + i);
+                    throw;
+                }
+            }
+        }
+
+        union {
+            Value values_[max_keys];
+        };
+        Leaf *prev_ = nullptr;
+        Leaf *next_ = nullptr;
+
+        friend class BTreeMap;
+        friend struct InternalNode;
+        friend class NodeFactory;
+    };
+
+    struct InternalNode : Node {
+    private:
+        explicit InternalNode(size_t level) noexcept {
+            this->level_ = level;
+        }
+
+        static void move_children(InternalNode *to, size_t to_index, InternalNode *from, size_t from_index,
+                                  size_t count) noexcept {
+            std::memmove(to->children_ + to_index, from->children_ + from_index, count * sizeof(Node *));
+        }
+
+        // A leaf hands a copy of the first key of its new right half up as
+        // the separator, an internal node its middle key itself.
+        void split_child_right(size_t index, BTreeMap &map) {
+            assert(this->key_num_ < max_keys);
+            Node *child = children_[index];
+            assert(child->key_num_ == max_keys);
+            size_t const new_keys = child->key_num_ / 2;
+
+            if (child->is_leaf_node()) {
+                Leaf *new_child = map.nodes_.make_leaf();
+                try {
+                    this->insert_key(index, child->keys_[new_keys]);
+                } catch (...) {
+                    map.nodes_.free(new_child);
+                    throw;
+                }
+                new_child->key_num_ = child->key_num_ - new_keys;
+                Leaf::move_entries(new_child, 0, child->as_leaf(), new_keys, new_child->key_num_);
+                child->key_num_ = new_keys;
+                map.link_after(child->as_leaf(), new_child);
+                move_children(this, index + 2, this, index + 1, this->key_num_ - index - 1);
+                children_[index + 1] = new_child;
+                return;
+            }
+
+            InternalNode *new_child = map.nodes_.make_internal(child->level_);
+            move_children(this, index + 2, this, index + 1, this->key_num_ - index);
+            this->open_gap(index);
+            Node::relocate(this->keys_ + index, child->keys_ + new_keys, 1);
+            children_[index + 1] = new_child;
+
+            size_t const offset = new_keys + 1;
+            new_child->key_num_ = child->key_num_ - offset;
+            Node::relocate(new_child->keys_, child->keys_ + offset, new_child->key_num_);
+            child->key_num_ = new_keys;
+            move_children(new_child, 0, child->as_internal(), offset, new_child->key_num_ + 1);
+        }
+
+        // Leaves drop the separator between them, internal nodes take it
+        // down between their keys.
+        void merge_child_with_right(size_t index, BTreeMap &map) noexcept {
+            assert(index < this->key_num_);
+            Node *center_child = children_[index];
+            Node *right_child = children_[index + 1];
+            size_t const right_keys = right_child->key_num_;
+            size_t const center_keys = center_child->key_num_;
+
+            if (center_child->is_leaf_node()) {
+                assert(center_keys + right_keys <= max_keys);
+                Leaf::move_entries(center_child->as_leaf(), center_keys, right_child->as_leaf(), 0, right_keys);
+                center_child->key_num_ += right_keys;
+                map.unlink(right_child->as_leaf());
+                this->remove_key(index);
+            } else {
+                assert(center_keys + right_keys < max_keys);
+                size_t const offset = center_keys + 1;
+                Node::relocate(center_child->keys_ + center_keys, this->keys_ + index, 1);
+                this->close_gap(index);
+                Node::relocate(center_child->keys_ + offset, right_child->keys_, right_keys);
+                move_children(center_child->as_internal(), offset, right_child->as_internal(), 0, right_keys + 1);
+                center_child->key_num_ += right_keys + 1;
+            }
+            right_child->key_num_ = 0;
+            move_children(this, index + 1, this, index + 2, this->key_num_ - index);
+            map.nodes_.free(right_child);
+        }
+
+        // Moves the last entry of the left neighbour of child index over to
+        // it. The new separator is copied before anything moves, so a
+        // throwing copy leaves the map as it was.
+        void take_from_left(size_t index) {
+            assert(index > 0);
+            Node *center_child = children_[index];
+            Node *left_child = children_[index - 1];
+            size_t const left_keys = left_child->key_num_;
+            size_t const center_keys = center_child->key_num_;
+            assert(left_keys > min_keys && center_keys < max_keys);
+
+            if (center_child->is_leaf_node()) {
+                this->keys_[index - 1] = left_child->keys_[left_keys - 1];
+                Leaf *center = center_child->as_leaf();
+                Leaf::move_entries(center, 1, center, 0, center_keys);
+                Leaf::move_entries(center, 0, left_child->as_leaf(), left_keys - 1, 1);
+            } else {
+                InternalNode *center = center_child->as_internal();
+                move_children(center, 1, center, 0, center_keys + 1);
+                move_children(center, 0, left_child->as_internal(), left_keys, 1);
+                Node::relocate(center_child->keys_ + 1, center_child->keys_, center_keys);
+                Node::relocate(center_child->keys_, this->keys_ + index - 1, 1);
+                Node::relocate(this->keys_ + index - 1, left_child->keys_ + left_keys - 1, 1);
+            }
+            --left_child->key_num_;
+            ++center_child->key_num_;
+        }
+
+        // The mirror image of take_from_left.
+        void take_from_right(size_t index) {
+            assert(index < this->key_num_);
+            Node *center_child = children_[index];
+            Node *right_child = children_[index + 1];
+            size_t const right_keys = right_child->key_num_;
+            size_t const center_keys = center_child->key_num_;
+            assert(right_keys > min_keys && center_keys < max_keys);
+
+            if (center_child->is_leaf_node()) {
+                this->keys_[index] = right_child->keys_[1];
+                Leaf *right = right_child->as_leaf();
+                Leaf::move_entries(center_child->as_leaf(), center_keys, right, 0, 1);
+                Leaf::move_entries(right, 0, right, 1, right_keys - 1);
+            } else {
+                Node::relocate(center_child->keys_ + center_keys, this->keys_ + index, 1);
+                Node::relocate(this->keys_ + index, right_child->keys_, 1);
+                Node::relocate(right_child->keys_, right_child->keys_ + 1, right_keys - 1);
+                InternalNode *right = right_child->as_internal();
+                move_children(center_child->as_internal(), center_keys + 1, right, 0, 1);
+                move_children(right, 0, right, 1, right_keys);
+            }
+            ++center_child->key_num_;
+            --right_child->key_num_;
+        }
+
+        // Borrows an entry for the underfull child index from a neighbour
+        // that can spare one, or merges it with a neighbour.
+        void fix_child(size_t index, BTreeMap &map) {
+            assert(children_[index]->key_num_ < min_keys);
+            if (index != 0 && children_[index - 1]->key_num_ > min_keys) {
+                take_from_left(index);
+            } else if (index != this->key_num_ && children_[index + 1]->key_num_ > min_keys) {
+                take_from_right(index);
+            } else {
+                merge_child_with_right(std::min(index, this->key_num_ - 1), map);
+            }
+        }
+
+        Node *children_[max_children]{};
+
+        friend class BTreeMap;
+        friend struct Node;
+        friend class NodeFactory;
+    };
+
+    // Makes and frees nodes through Allocator rebound to each node layout.
+    class NodeFactory {
+        using leaf_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Leaf>;
+        using leaf_traits = std::allocator_traits<leaf_allocator>;
+        using internal_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<InternalNode>;
+        using internal_traits = std::allocator_traits<internal_allocator>;
+
+    public:
+        NodeFactory() = default;
+
+        explicit NodeFactory(Allocator const &allocator) : allocator_(allocator) {}
+
+        [[nodiscard]] Allocator get_allocator() const {
+            return Allocator(allocator_);
+        }
+
+        [[nodiscard]] Leaf *make_leaf() {
+            Leaf *node = std::to_address(leaf_traits::allocate(allocator_, 1));
+            return ::new(static_cast<void *>(node)) Leaf();
+        }
+
+        [[nodiscard]] InternalNode *make_internal(size_t level) {
+            internal_allocator allocator(allocator_);
+            InternalNode *node = std::to_address(internal_traits::allocate(allocator, 1));
+            return ::new(static_cast<void *>(node)) InternalNode(level);
+        }
+
+        // Frees a single node, but not its children.
+        void free(Node *node) noexcept {
+            if (node->is_leaf_node()) {
+                Leaf *leaf = node->as_leaf();
+                leaf->~Leaf();
+                leaf_traits::deallocate(allocator_, leaf, 1);
+            } else {
+                InternalNode *internal = node->as_internal();
+                internal->~InternalNode();
+                internal_allocator allocator(allocator_);
+                internal_traits::deallocate(allocator, internal, 1);
+            }
+        }
+
+        // Frees the node along with its subtree.
+        void destroy(Node *node) noexcept {
+            if (node->is_internal_node()) {
+                for (size_t i = 0; i <= node->key_num_; ++i) {
+                    destroy(node->child(i));
+                }
+            }
+            free(node);
+        }
+
+        // Copies the subtree, linking its leaves after last, which ends up
+        // being the last leaf of the copy. Frees what it copied if it throws.
+        [[nodiscard]] Node *clone(Node const *node, Leaf *&last) {
+            if (node->is_leaf_node()) {
+                Leaf *copy = make_leaf();
+                try {
+                    copy->copy_entries(static_cast<Leaf const *>(node));
+                } catch (...) {
+                    free(copy);
+                    throw;
+                }
+                copy->prev_ = last;
+                if (last != nullptr) last->next_ = copy;
+                last = copy;
+                return copy;
+            }
+            InternalNode *copy = make_internal(node->level_);
+            size_t i = 0;
+            try {
+                copy->copy_keys(node);
+                for (; i <= node->key_num_; ++i) {
+                    copy->children_[i] = clone(node->child(i), last);
+                }
+            } catch (...) {
+                while (i-- > 0) {
+                    destroy(copy->children_[i]);
+                }
+                free(copy);
+                throw;
+            }
+            return copy;
+        }
+
+    private:
+        [[no_unique_address]] leaf_allocator allocator_;
+    };
+
+    // A position in the leaf list, the end being past the last leaf. The
+    // entries are not stored as pairs, so dereferencing makes a pair of
+    // references to the key and the value.
+    template<bool Const>
+    class Iterator {
+        using mapped_reference = std::conditional_t<Const, Value const &, Value &>;
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = std::pair<Key, Value>;
+        using reference = std::pair<Key const &, mapped_reference>;
+
+        struct pointer {
+            reference entry;
+
+            reference const *operator->() const noexcept {
+                return &entry;
+            }
+        };
+
+        Iterator() noexcept = default;
+
+        // iterator converts to const_iterator.
+        template<bool OtherConst> requires (Const && !OtherConst)
+        Iterator(Iterator<OtherConst> const &other) noexcept
+                : map_(other.map_), leaf_(other.leaf_), index_(other.index_) {}
+
+        Iterator &operator--() noexcept {
+            if (leaf_ == nullptr) {
+                leaf_ = map_->last_;
+                index_ = leaf_->key_num_;
+            } else if (index_ == 0) {
+                leaf_ = leaf_->prev_;
+                index_ = leaf_->key_num_;
+            }
+            --index_;
+            return *this;
+        }
+
+        Iterator operator--(int) noexcept {
+            Iterator temp{*this};
+            --(*this);
+            return temp;
+        }
+
+        Iterator &operator++() noexcept {
+            if (++index_ == leaf_->key_num_) {
+                leaf_ = leaf_->next_;
+                index_ = 0;
+            }
+            return *this;
+        }
+
+        Iterator operator++(int) noexcept {
+            Iterator temp{*this};
+            ++(*this);
+            return temp;
+        }
+
+        reference operator*() const noexcept {
+            return {leaf_->keys_[index_], leaf_->values_[index_]};
+        }
+
+        pointer operator->() const noexcept {
+            return {**this};
+        }
+
+        friend bool operator==(Iterator const &a, Iterator const &b) noexcept {
+            assert(a.map_ == b.map_);
+            return a.leaf_ == b.leaf_ && a.index_ == b.index_;
+        }
+
+    private:
+        // Past the end of a leaf means the start of the next one.
+        Iterator(BTreeMap const &map, Leaf *leaf, size_t index) noexcept
+                : map_(&map), leaf_(leaf), index_(index) {
+            if (leaf_ != nullptr && index_ == leaf_->key_num_) {
+                leaf_ = leaf_->next_;
+                index_ = 0;
+            }
+        }
+
+        BTreeMap const *map_ = nullptr;
+        Leaf *leaf_ = nullptr;
+        size_t index_ = 0;
+
+        friend class BTreeMap;
+        friend class Iterator<true>;
+    };
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using allocator_type = Allocator;
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    BTreeMap() = default;
+
+    explicit BTreeMap(Comparator comparator, Allocator const &allocator = Allocator())
+            : nodes_(allocator), comparator_(comparator) {}
+
+    explicit BTreeMap(Allocator const &allocator) : nodes_(allocator) {}
+
+    BTreeMap(BTreeMap const &other) requires std::copyable<Value>
+            : nodes_(std::allocator_traits<Allocator>::select_on_container_copy_construction(other.get_allocator())),
+              comparator_(other.comparator_) {
+        if (other.root_ == nullptr) return;
+        root_ = nodes_.clone(other.root_, last_);
+        first_ = leftmost_leaf(root_);
+        size_ = other.size_;
+    }
+
+    BTreeMap &operator=(BTreeMap const &other) requires std::copyable<Value> {
+        if (this != &other) {
+            BTreeMap(other).swap(*this);
+        }
+        return *this;
+    }
+
+    BTreeMap(BTreeMap &&other) noexcept
+            : root_(std::exchange(other.root_, nullptr)), first_(std::exchange(other.first_, nullptr)),
+              last_(std::exchange(other.last_, nullptr)), size_(std::exchange(other.size_, 0)),
+              nodes_(other.nodes_), comparator_(other.comparator_) {}
+
+    BTreeMap &operator=(BTreeMap &&other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    void swap(BTreeMap &other) noexcept {
+        std::swap(root_, other.root_);
+        std::swap(first_, other.first_);
+        std::swap(last_, other.last_);
+        std::swap(size_, other.size_);
+        std::swap(comparator_, other.comparator_);
+        if constexpr (std::allocator_traits<Allocator>::propagate_on_container_swap::value) {
+            std::swap(nodes_, other.nodes_);
+        }
+    }
+
+    [[nodiscard]] Allocator get_allocator() const {
+        return nodes_.get_allocator();
+    }
+
+    [[nodiscard]] bool empty() const {
+        return root_ == nullptr;
+    }
+
+    [[nodiscard]] size_t size() const noexcept {
+        return size_;
+    }
+
+    iterator find(Key const &key) {
+        return find<Key>(key);
+    }
+
+    const_iterator find(Key const &key) const {
+        return find<Key>(key);
+    }
+
+    template<typename K> requires lookup_key<K>
+    iterator find(K const &key) {
+        return to_mutable(std::as_const(*this).find(key));
+    }
+
+    template<typename K> requires lookup_key<K>
+    const_iterator find(K const &key) const {
+        if (root_ == nullptr) return end();
+        Leaf *leaf = find_leaf(key);
+        size_t const index = find_index(leaf, key);
+        if (index == leaf->key_num_ || comparator_(key, leaf->keys_[index])) return end();
+        return const_iterator(*this, leaf, index);
+    }
+
+    iterator lower_bound(Key const &key) {
+        return lower_bound<Key>(key);
+    }
+
+    const_iterator lower_bound(Key const &key) const {
+        return lower_bound<Key>(key);
+    }
+
+    template<typename K> requires lookup_key<K>
+    iterator lower_bound(K const &key) {
+        return to_mutable(std::as_const(*this).lower_bound(key));
+    }
+
+    template<typename K> requires lookup_key<K>
+    const_iterator lower_bound(K const &key) const {
+        if (root_ == nullptr) return end();
+        Leaf *leaf = find_leaf(key);
+        return const_iterator(*this, leaf, find_index(leaf, key));
+    }
+
+    iterator upper_bound(Key const &key) {
+        return upper_bound<Key>(key);
+    }
+
+    const_iterator upper_bound(Key const &key) const {
+        return upper_bound<Key>(key);
+    }
+
+    template<typename K> requires lookup_key<K>
+    iterator upper_bound(K const &key) {
+        return to_mutable(std::as_const(*this).upper_bound(key));
+    }
+
+    template<typename K> requires lookup_key<K>
+    const_iterator upper_bound(K const &key) const {
+        if (root_ == nullptr) return end();
+        Leaf *leaf = find_leaf(key);
+        return const_iterator(*this, leaf, find_upper_index(leaf, key));
+    }
+
+    bool contains(Key const &key) const {
+        return contains<Key>(key);
+    }
+
+    template<typename K> requires lookup_key<K>
+    bool contains(K const &key) const {
+        return find(key) != end();
+    }
+
+    Value &at(Key const &key) {
+        return at<Key>(key);
+    }
+
+    Value const &at(Key const &key) const {
+        return at<Key>(key);
+    }
+
+    template<typename K> requires lookup_key<K>
+    Value &at(K const &key) {
+        return const_cast<Value &>(std::as_const(*this).at(key));
+    }
+
+    template<typename K> requires lookup_key<K>
+    Value const &at(K const &key) const {
+        const_iterator it = find(key);
+        if (it == end()) throw std::out_of_range("BTreeMap::at: no such key");
+        return it.leaf_->values_[it.index_];
+    }
+
+    Value &operator[](Key const &key) requires std::default_initializable<Value> {
+        iterator it = try_emplace(key).first;
+        return it.leaf_->values_[it.index_];
+    }
+
+    Value &operator[](Key &&key) requires std::default_initializable<Value> {
+        iterator it = try_emplace(std::move(key)).first;
+        return it.leaf_->values_[it.index_];
+    }
+
+    // Constructs the value from args if key is not in the map yet, and
+    // leaves args alone otherwise. Returns where the key is and whether it
+    // was added.
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key const &key, Args &&... args) {
+        return emplace_unique(key, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key &&key, Args &&... args) {
+        return emplace_unique(std::move(key), std::forward<Args>(args)...);
+    }
+
+    // Adds the key with the value, or assigns the value to the key that is
+    // already there.
+    template<typename V>
+    std::pair<iterator, bool> insert_or_assign(Key const &key, V &&value) {
+        auto result = try_emplace(key, std::forward<V>(value));
+        if (!result.second) result.first.leaf_->values_[result.first.index_] = std::forward<V>(value);
+        return result;
+    }
+
+    template<typename V>
+    std::pair<iterator, bool> insert_or_assign(Key &&key, V &&value) {
+        auto result = try_emplace(std::move(key), std::forward<V>(value));
+        if (!result.second) result.first.leaf_->values_[result.first.index_] = std::forward<V>(value);
+        return result;
+    }
+
+    // Removes the key along with its value, returns whether it was there.
+    // Underfull nodes are fixed on the way back up.
+    bool remove(Key const &key) {
+        return remove<Key>(key);
+    }
+
+    template<typename K> requires lookup_key<K>
+    bool remove(K const &key) {
+        if (root_ == nullptr) return false;
+
+        struct Step {
+            InternalNode *node;
+            size_t index;
+        };
+        Step path[max_height];
+        size_t depth = 0;
+        Node *node = root_;
+        while (node->is_internal_node()) {
+            size_t const index = find_upper_index(node, key);
+            path[depth++] = {node->as_internal(), index};
+            node = node->child(index);
+        }
+
+        size_t const index = find_index(node, key);
+        if (index == node->key_num_ || comparator_(key, node->keys_[index])) return false;
+
+        node->as_leaf()->erase(index);
+        --size_;
+        while (depth != 0 && node->key_num_ < min_keys) {
+            Step const step = path[--depth];
+            step.node->fix_child(step.index, *this);
+            node = step.node;
+        }
+        if (root_->key_num_ == 0) {
+            Node *old_root = root_;
+            if (old_root->is_leaf_node()) {
+                root_ = first_ = last_ = nullptr;
+            } else {
+                root_ = old_root->child(0);
+            }
+            nodes_.free(old_root);
+        }
+        return true;
+    }
+
+    void clear() {
+        if (root_ == nullptr) return;
+        nodes_.destroy(root_);
+        root_ = first_ = last_ = nullptr;
+        size_ = 0;
+    }
+
+    iterator begin() { return iterator(*this, first_, 0); }
+
+    iterator end() { return iterator(*this, nullptr, 0); }
+
+    const_iterator begin() const { return const_iterator(*this, first_, 0); }
+
+    const_iterator end() const { return const_iterator(*this, nullptr, 0); }
+
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    ~BTreeMap() {
+        clear();
+    }
+
+private:
+    Node *root_ = nullptr;
+    Leaf *first_ = nullptr;
+    Leaf *last_ = nullptr;
+    size_t size_ = 0;
+    NodeFactory nodes_{};
+    Comparator comparator_{};
+
+    static Leaf *leftmost_leaf(Node *node) noexcept {
+        while (node->is_internal_node()) {
+            node = node->child(0);
+        }
+        return node->as_leaf();
+    }
+
+    iterator to_mutable(const_iterator it) noexcept {
+        return iterator(*this, it.leaf_, it.index_);
+    }
+
+    // The leaf that holds key if the map does.
+    template<typename K>
+    Leaf *find_leaf(K const &key) const {
+        Node *node = root_;
+        while (node->is_internal_node()) {
+            node = node->child(find_upper_index(node, key));
+        }
+        return node->as_leaf();
+    }
+
+    // Looks for the key without changing anything first, so that finding
+    // it or adding it to a leaf with room takes a single descent. Only a
+    // full leaf sends the insert down again, splitting the full nodes on
+    // the way.
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> emplace_unique(K &&key, Args &&... args) {
+        if (root_ == nullptr) {
+            Leaf *leaf = nodes_.make_leaf();
+            try {
+                leaf->emplace(0, std::forward<K>(key), std::forward<Args>(args)...);
+            } catch (...) {
+                nodes_.free(leaf);
+                throw;
+            }
+            root_ = first_ = last_ = leaf;
+            size_ = 1;
+            return {iterator(*this, leaf, 0), true};
+        }
+
+        Leaf *leaf = find_leaf(key);
+        size_t index = find_index(leaf, key);
+        if (index != leaf->key_num_ && !comparator_(key, leaf->keys_[index])) {
+            return {iterator(*this, leaf, index), false};
+        }
+
+        if (leaf->is_full()) {
+            if (root_->is_full()) {
+                InternalNode *new_root = nodes_.make_internal(root_->level_ + 1);
+                new_root->children_[0] = root_;
+                try {
+                    new_root->split_child_right(0, *this);
+                } catch (...) {
+                    nodes_.free(new_root);
+                    throw;
+                }
+                root_ = new_root;
+            }
+            Node *node = root_;
+            while (node->is_internal_node()) {
+                InternalNode *internal = node->as_internal();
+                size_t child = find_upper_index(node, key);
+                if (internal->children_[child]->is_full()) {
+                    internal->split_child_right(child, *this);
+                    if (!comparator_(key, node->keys_[child])) ++child;
+                }
+                node = internal->children_[child];
+            }
+            leaf = node->as_leaf();
+            index = find_index(leaf, key);
+        }
+        leaf->emplace(index, std::forward<K>(key), std::forward<Args>(args)...);
+        ++size_;
+        return {iterator(*this, leaf, index), true};
+    }
+
+    void link_after(Leaf *leaf, Leaf *new_leaf) noexcept {
+        new_leaf->prev_ = leaf;
+        new_leaf->next_ = leaf->next_;
+        if (leaf->next_ != nullptr) leaf->next_->prev_ = new_leaf;
+        else last_ = new_leaf;
+        leaf->next_ = new_leaf;
+    }
+
+    // Never the first leaf, merges keep the left one.
+    void unlink(Leaf *leaf) noexcept {
+        assert(leaf->prev_ != nullptr);
+        leaf->prev_->next_ = leaf->next_;
+        if (leaf->next_ != nullptr) leaf->next_->prev_ = leaf->prev_;
+        else last_ = leaf->prev_;
+    }
+
+    // The first key not less than key.
+    template<typename K>
+    size_t find_index(Node const *node, K const &key) const {
+#ifdef B_TREE_AVX2_SEARCH
+        if constexpr (std::same_as<K, Key> && detail::vector_searchable<Key, Comparator>) {
+            if (detail::cpu_has_avx2) return detail::vector_search<false>(node->keys_, node->key_num_, key);
+        }
+#endif
+        Key const *left = node->keys_;
+        Key const *right = left + node->key_num_;
+        while (right != left) {
+            Key const *mid = left + (right - left) / 2;
+            if (comparator_(*mid, key)) left = mid + 1;
+            else right = mid;
+        }
+        return left - node->keys_;
+    }
+
+    // The first key greater than key.
+    template<typename K>
+    size_t find_upper_index(Node const *node, K const &key) const {
+#ifdef B_TREE_AVX2_SEARCH
+        if constexpr (std::same_as<K, Key> && detail::vector_searchable<Key, Comparator>) {
+            if (detail::cpu_has_avx2) return detail::vector_search<true>(node->keys_, node->key_num_, key);
+        }
+#endif
+        Key const *left = node->keys_;
+        Key const *right = left + node->key_num_;
+        while (right != left) {
+            Key const *mid = left + (right - left) / 2;
+            if (comparator_(key, *mid)) right = mid;
+            else left = mid + 1;
+        }
+        return left - node->keys_;
+    }
+};
+
+}  // namespace b_tree
@@ -0,0 +1,595 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <type_traits>
+
+#include "key_search.h"
+
+namespace b_tree {
+
+// A set that any number of threads may search and change at once, using
+// optimistic lock coupling (Leis et al., "The ART of Practical
+// Synchronization"). Every node carries a version that writers bump. Readers
+// take no locks: they note a node's version, read it and only trust what
+// they read if the version is still the same afterwards, starting over
+// otherwise. Writers lock just the nodes they change, at most a node and
+// its parent when splitting.
+//
+// Like BPlusTree, keys live in the leaves and internal nodes hold copies of
+// them. Removing leaves nodes underfull rather than merging them, so no node
+// is freed before the tree is destroyed and readers never step on freed
+// memory. The flip side is that the tree never shrinks: it keeps a node for
+// every range of keys it ever held, so a workload that goes on inserting
+// new keys and removing old ones grows it without bound, however few keys
+// are in it at a time. Such trees have to be rebuilt now and then.
+//
+// Readers may copy keys out while they are being written, so keys are kept
+// as words that are only ever read and written atomically, and have to be
+// trivially copyable. Comparator must not mind comparing torn keys (the
+// result is thrown away). Allocator has to be safe to call from several
+// threads at once.
+template<typename T, size_t Order, typename Comparator = std::less<>, typename Allocator = std::allocator<T>>
+requires std::is_trivially_copyable_v<T>
+class ConcurrentBTree {
+    static_assert(Order > 1, "Order must be greater than 1");
+
+    static constexpr size_t max_children = Order * 2;
+    static constexpr size_t max_keys = max_children - 1;
+
+    // See BTree::lookup_key.
+    template<typename K>
+    static constexpr bool lookup_key = std::same_as<K, T> || requires { typename Comparator::is_transparent; };
+
+    struct InternalNode;
+    class NodeFactory;
+
+    // Keys are kept as words of this size, the widest that key sizes are
+    // a multiple of, and always read and written through atomic word
+    // loads and stores: a reader may be copying a key out while a writer
+    // overwrites it.
+    using Word = std::conditional_t<sizeof(T) % 8 == 0, uint64_t,
+            std::conditional_t<sizeof(T) % 4 == 0, uint32_t,
+                    std::conditional_t<sizeof(T) % 2 == 0, uint16_t, uint8_t>>>;
+    static constexpr size_t key_words = sizeof(T) / sizeof(Word);
+
+    // Separator i of an internal node is greater than the keys under child
+    // i and no greater than those under child i + 1. Everything a reader
+    // may look at while a writer changes it is atomic, the level is set
+    // before the node is published and never changes.
+    struct Node {
+    private:
+        static constexpr uint64_t locked = 2;
+
+        Node() noexcept = default;  // a leaf
+
+        // The version to check reads against, once no writer holds the node.
+        [[nodiscard]] uint64_t stable_version() const noexcept {
+            uint64_t version = version_.load(std::memory_order_acquire);
+            for (size_t spins = 0; version & locked; ++spins) {
+                if (spins % 64 == 63) std::this_thread::yield();
+                version = version_.load(std::memory_order_acquire);
+            }
+            return version;
+        }
+
+        // Whether what was read since the version was taken is still what
+        // the node holds.
+        [[nodiscard]] bool validate(uint64_t version) const noexcept {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return version_.load(std::memory_order_relaxed) == version;
+        }
+
+        // Locks the node unless it has changed since version. The fence
+        // keeps the writes that follow from showing before the lock does.
+        [[nodiscard]] bool try_lock(uint64_t version) noexcept {
+            if (!version_.compare_exchange_strong(version, version + locked, std::memory_order_acquire)) return false;
+            std::atomic_thread_fence(std::memory_order_release);
+            return true;
+        }
+
+        void unlock() noexcept {
+            version_.fetch_add(locked, std::memory_order_release);
+        }
+
+        [[nodiscard]] bool is_full() const noexcept {
+            return key_count() == max_keys;
+        }
+
+        [[nodiscard]] bool is_leaf_node() const noexcept {
+            return level_ == 0;
+        }
+
+        [[nodiscard]] bool is_internal_node() const noexcept {
+            return level_ != 0;
+        }
+
+        [[nodiscard]] size_t key_count() const noexcept {
+            return key_num_.load(std::memory_order_relaxed);
+        }
+
+        // A copy of key index, torn if a writer is changing it.
+        [[nodiscard]] T key(size_t index) const noexcept {
+            std::array<Word, key_words> words;
+            load_words(words.data(), index * key_words, key_words);
+            return std::bit_cast<T>(words);
+        }
+
+        // Copies count keys from index on into to.
+        void load_keys(T *to, size_t index, size_t count) const noexcept {
+            for (size_t i = 0; i < count; ++i) {
+                std::construct_at(to + i, key(index + i));
+            }
+        }
+
+        void store_key(size_t index, T const &value) noexcept {
+            auto const words = std::bit_cast<std::array<Word, key_words>>(value);
+            for (size_t i = 0; i < key_words; ++i) {
+                word(index * key_words + i).store(words[i], std::memory_order_relaxed);
+            }
+        }
+
+        void insert_key(size_t index, T const &value) noexcept {
+            size_t const count = key_count();
+            assert(index <= count && count < max_keys);
+            move_keys(index + 1, index, count - index);
+            store_key(index, value);
+            key_num_.store(count + 1, std::memory_order_relaxed);
+        }
+
+        void remove_key(size_t index) noexcept {
+            size_t const count = key_count();
+            assert(index < count);
+            move_keys(index, index + 1, count - index - 1);
+            key_num_.store(count - 1, std::memory_order_relaxed);
+        }
+
+        // Copies count keys starting at from of other to this node from to
+        // on.
+        void copy_keys(size_t to, Node const *other, size_t from, size_t count) noexcept {
+            for (size_t i = 0; i < count * key_words; ++i) {
+                word(to * key_words + i).store(other->word(from * key_words + i).load(std::memory_order_relaxed),
+                                               std::memory_order_relaxed);
+            }
+        }
+
+        // Moves count keys from index from to index to of this node, the
+        // ranges may overlap.
+        void move_keys(size_t to, size_t from, size_t count) noexcept {
+            size_t const words = count * key_words;
+            to *= key_words;
+            from *= key_words;
+            if (to < from) {
+                for (size_t i = 0; i < words; ++i) {
+                    word(to + i).store(word(from + i).load(std::memory_order_relaxed), std::memory_order_relaxed);
+                }
+            } else {
+                for (size_t i = words; i > 0; --i) {
+                    word(to + i - 1).store(word(from + i - 1).load(std::memory_order_relaxed),
+                                           std::memory_order_relaxed);
+                }
+            }
+        }
+
+        void load_words(Word *to, size_t from, size_t count) const noexcept {
+            for (size_t i = 0; i < count; ++i) {
+                to[i] = word(from + i).load(std::memory_order_relaxed);
+            }
+        }
+
+        [[nodiscard]] std::atomic_ref<Word> word(size_t index) const noexcept {
+            return std::atomic_ref<Word>(const_cast<Word &>(words_[index]));
+        }
+
+        [[nodiscard]] InternalNode *as_internal() noexcept {
+            assert(this->is_internal_node());
+            return static_cast<InternalNode *>(this);
+        }
+
+        [[nodiscard]] Node *child(size_t index) const noexcept {
+            return static_cast<InternalNode const *>(this)->children_[index].load(std::memory_order_acquire);
+        }
+
+        std::atomic<uint64_t> version_{0};
+        std::atomic<size_t> key_num_{0};
+        std::uint8_t level_{0};
+        alignas(T) alignas(std::atomic_ref<Word>::required_alignment) Word words_[max_keys * key_words]{};
+
+        friend class ConcurrentBTree;
+        friend struct InternalNode;
+        friend class NodeFactory;
+    };
+
+    struct InternalNode : Node {
+    private:
+        explicit InternalNode(size_t level) noexcept {
+            this->level_ = level;
+        }
+
+        // Puts child right after child index, with separator between them.
+        void insert_child(size_t index, T const &separator, Node *child) noexcept {
+            size_t const count = this->key_count();
+            assert(count < max_keys);
+            for (size_t i = count + 1; i > index + 1; --i) {
+                set_child(i, this->child(i - 1));
+            }
+            this->insert_key(index, separator);
+            set_child(index + 1, child);
+        }
+
+        // Publishing a child with release lets readers that load it see
+        // all that was written into it before.
+        void set_child(size_t index, Node *child) noexcept {
+            children_[index].store(child, std::memory_order_release);
+        }
+
+        std::atomic<Node *> children_[max_children]{};
+
+        friend class ConcurrentBTree;
+        friend struct Node;
+        friend class NodeFactory;
+    };
+
+    // Makes and frees nodes through Allocator rebound to each node layout.
+    class NodeFactory {
+        using leaf_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+        using leaf_traits = std::allocator_traits<leaf_allocator>;
+        using internal_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<InternalNode>;
+        using internal_traits = std::allocator_traits<internal_allocator>;
+
+    public:
+        NodeFactory() = default;
+
+        explicit NodeFactory(Allocator const &allocator) : allocator_(allocator) {}
+
+        [[nodiscard]] Allocator get_allocator() const {
+            return Allocator(allocator_);
+        }
+
+        [[nodiscard]] Node *make_leaf() {
+            Node *node = std::to_address(leaf_traits::allocate(allocator_, 1));
+            return ::new(static_cast<void *>(node)) Node();
+        }
+
+        [[nodiscard]] InternalNode *make_internal(size_t level) {
+            internal_allocator allocator(allocator_);
+            InternalNode *node = std::to_address(internal_traits::allocate(allocator, 1));
+            return ::new(static_cast<void *>(node)) InternalNode(level);
+        }
+
+        [[nodiscard]] Node *make_sibling(Node const *node) {
+            if (node->is_leaf_node()) return make_leaf();
+            return make_internal(node->level_);
+        }
+
+        // Frees a single node, but not its children.
+        void free(Node *node) noexcept {
+            if (node->is_leaf_node()) {
+                node->~Node();
+                leaf_traits::deallocate(allocator_, node, 1);
+            } else {
+                InternalNode *internal = node->as_internal();
+                internal->~InternalNode();
+                internal_allocator allocator(allocator_);
+                internal_traits::deallocate(allocator, internal, 1);
+            }
+        }
+
+        // Frees the node along with its subtree.
+        void destroy(Node *node) noexcept {
+            if (node->is_internal_node()) {
+                for (size_t i = 0; i <= node->key_count(); ++i) {
+                    destroy(node->child(i));
+                }
+            }
+            free(node);
+        }
+
+    private:
+        [[no_unique_address]] leaf_allocator allocator_;
+    };
+
+public:
+    using allocator_type = Allocator;
+
+    ConcurrentBTree() : ConcurrentBTree(Allocator()) {}
+
+    explicit ConcurrentBTree(Comparator comparator, Allocator const &allocator = Allocator())
+            : nodes_(allocator), comparator_(comparator) {
+        root_.store(nodes_.make_leaf(), std::memory_order_relaxed);
+    }
+
+    explicit ConcurrentBTree(Allocator const &allocator) : ConcurrentBTree(Comparator(), allocator) {}
+
+    ConcurrentBTree(ConcurrentBTree const &) = delete;
+
+    ConcurrentBTree &operator=(ConcurrentBTree const &) = delete;
+
+    ~ConcurrentBTree() {
+        nodes_.destroy(root_.load(std::memory_order_relaxed));
+    }
+
+    [[nodiscard]] Allocator get_allocator() const {
+        return nodes_.get_allocator();
+    }
+
+    bool contains(T const &value) const {
+        return contains<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    bool contains(K const &value) const {
+        while (true) {
+            uint64_t version;
+            Node const *leaf = find_leaf(value, version);
+            if (leaf == nullptr) continue;
+            bool const found = find_slot(leaf, value).found;
+            if (leaf->validate(version)) return found;
+        }
+    }
+
+    // A copy of the key equal to value, if there is one.
+    std::optional<T> find(T const &value) const {
+        return find<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    std::optional<T> find(K const &value) const {
+        while (true) {
+            uint64_t version;
+            Node const *leaf = find_leaf(value, version);
+            if (leaf == nullptr) continue;
+            Slot const slot = find_slot(leaf, value);
+            std::optional<T> key;
+            if (slot.found) key = leaf->key(slot.index);
+            if (leaf->validate(version)) return key;
+        }
+    }
+
+    // Adds value unless an equal key is there already, returns whether it
+    // did.
+    bool insert(T const &value) {
+        while (true) {
+            if (auto const inserted = try_insert(value)) return *inserted;
+        }
+    }
+
+    // Removes the key equal to value, returns whether there was one.
+    bool remove(T const &value) {
+        return remove<T>(value);
+    }
+
+    template<typename K> requires lookup_key<K>
+    bool remove(K const &value) {
+        while (true) {
+            uint64_t version;
+            Node *leaf = find_leaf(value, version);
+            if (leaf == nullptr) continue;
+            Slot const slot = find_slot(leaf, value);
+            if (!slot.found) {
+                if (leaf->validate(version)) return false;
+                continue;
+            }
+            if (!leaf->try_lock(version)) continue;
+            leaf->remove_key(slot.index);
+            leaf->unlock();
+            return true;
+        }
+    }
+
+    // Counts the keys by walking the whole tree, which is only exact while
+    // no other thread changes it.
+    [[nodiscard]] size_t size() const noexcept {
+        return count_keys(root_.load(std::memory_order_acquire));
+    }
+
+private:
+    std::atomic<Node *> root_;
+    NodeFactory nodes_{};
+    Comparator comparator_{};
+
+    struct Slot {
+        size_t index;
+        bool found;
+    };
+
+    // Goes down to the leaf that would hold value. Returns null if a writer
+    // got in the way, the leaf and its version otherwise.
+    template<typename K>
+    Node *find_leaf(K const &value, uint64_t &version) const {
+        Node *node = root_.load(std::memory_order_acquire);
+        version = node->stable_version();
+        if (node != root_.load(std::memory_order_acquire)) return nullptr;
+        while (node->is_internal_node()) {
+            Node *child = step_down(node, version, find_upper_index(node, value), version);
+            if (child == nullptr) return nullptr;
+            node = child;
+        }
+        return node;
+    }
+
+    // Child index of node, read at version, along with the child's own
+    // version, or null if node changed. The parent is checked again once
+    // the child's version is taken, since a split in between could have
+    // moved the keys looked for out of the child.
+    static Node *step_down(Node const *node, uint64_t version, size_t index, uint64_t &child_version) noexcept {
+        Node *child = node->child(index);
+        if (!node->validate(version)) return nullptr;
+        child_version = child->stable_version();
+        if (!node->validate(version)) return nullptr;
+        return child;
+    }
+
+    // One try at inserting value, or nothing if a writer got in the way.
+    // Full nodes on the way down get split first, which only takes locking
+    // the node and its parent, since the parent has room: it was split on
+    // the way down otherwise.
+    std::optional<bool> try_insert(T const &value) {
+        Node *node = root_.load(std::memory_order_acquire);
+        uint64_t version = node->stable_version();
+        if (node != root_.load(std::memory_order_acquire)) return std::nullopt;
+        InternalNode *parent = nullptr;
+        uint64_t parent_version = 0;
+        size_t index = 0;
+
+        while (node->is_internal_node()) {
+            if (node->is_full()) {
+                split(parent, parent_version, index, node, version);
+                return std::nullopt;
+            }
+            parent = node->as_internal();
+            parent_version = version;
+            index = find_upper_index(node, value);
+            node = step_down(parent, parent_version, index, version);
+            if (node == nullptr) return std::nullopt;
+        }
+
+        Slot const slot = find_slot(node, value);
+        if (slot.found) {
+            if (node->validate(version)) return false;
+            return std::nullopt;
+        }
+        if (node->is_full()) {
+            split(parent, parent_version, index, node, version);
+            return std::nullopt;
+        }
+        if (!node->try_lock(version)) return std::nullopt;
+        node->insert_key(slot.index, value);
+        node->unlock();
+        return true;
+    }
+
+    // Moves the upper half of the full node, child index of parent or the
+    // root if parent is null, into a new sibling. Gives up if either node
+    // changed since it was read at the given version, the caller starts
+    // over either way. Nodes are made before anything is locked, so
+    // running out of memory leaves the tree alone.
+    void split(InternalNode *parent, uint64_t parent_version, size_t index, Node *node, uint64_t version) {
+        Node *sibling = nodes_.make_sibling(node);
+        InternalNode *new_root = nullptr;
+        if (parent == nullptr) {
+            try {
+                new_root = nodes_.make_internal(node->level_ + 1);
+            } catch (...) {
+                nodes_.free(sibling);
+                throw;
+            }
+        }
+        auto const give_up = [&] {
+            nodes_.free(sibling);
+            if (new_root != nullptr) nodes_.free(new_root);
+        };
+        if (parent != nullptr && !parent->try_lock(parent_version)) return give_up();
+        if (!node->try_lock(version)) {
+            if (parent != nullptr) parent->unlock();
+            return give_up();
+        }
+        if (parent == nullptr && node != root_.load(std::memory_order_relaxed)) {
+            node->unlock();
+            return give_up();
+        }
+
+        // A leaf hands a copy of the first key of its new right half up as
+        // the separator, an internal node its middle key itself.
+        size_t const kept = max_keys / 2;
+        T const separator = node->key(kept);
+        if (node->is_leaf_node()) {
+            sibling->copy_keys(0, node, kept, max_keys - kept);
+            sibling->key_num_.store(max_keys - kept, std::memory_order_relaxed);
+        } else {
+            size_t const moved = max_keys - kept - 1;
+            sibling->copy_keys(0, node, kept + 1, moved);
+            sibling->key_num_.store(moved, std::memory_order_relaxed);
+            for (size_t i = 0; i <= moved; ++i) {
+                sibling->as_internal()->set_child(i, node->child(kept + 1 + i));
+            }
+        }
+        node->key_num_.store(kept, std::memory_order_relaxed);
+
+        if (parent != nullptr) {
+            parent->insert_child(index, separator, sibling);
+        } else {
+            new_root->insert_key(0, separator);
+            new_root->set_child(0, node);
+            new_root->set_child(1, sibling);
+            root_.store(new_root, std::memory_order_release);
+        }
+        node->unlock();
+        if (parent != nullptr) parent->unlock();
+    }
+
+    size_t count_keys(Node const *node) const noexcept {
+        if (node->is_leaf_node()) return node->key_count();
+        size_t count = 0;
+        for (size_t i = 0; i <= node->key_count(); ++i) {
+            count += count_keys(node->child(i));
+        }
+        return count;
+    }
+
+    template<typename A, typename B>
+    bool less(A const &a, B const &b) const {
+        return comparator_(a, b);
+    }
+
+    // The first key not less than value, and whether it equals value.
+    template<typename K>
+    Slot find_slot(Node const *node, K const &value) const {
+        size_t const count = node->key_count();
+        size_t const index = search<false>(node, count, value);
+        return {index, index != count && !less(value, node->key(index))};
+    }
+
+    // The first key greater than value.
+    template<typename K>
+    size_t find_upper_index(Node const *node, K const &value) const {
+        return search<true>(node, node->key_count(), value);
+    }
+
+    // The first of the count keys not less than value, or greater than it
+    // for Upper. Every key looked at is copied out of the node first. The
+    // vector search halves down to a cache line of keys, then copies those
+    // out and counts through the copy.
+    template<bool Upper, typename K>
+    size_t search(Node const *node, size_t count, K const &value) const {
+        size_t base = 0;
+#ifdef B_TREE_AVX2_SEARCH
+        if constexpr (std::same_as<K, T> && detail::vector_searchable<T, Comparator>) {
+            if (detail::cpu_has_avx2) {
+                constexpr size_t window = 64 / sizeof(T);
+                while (count > window) {
+                    size_t const half = count / 2;
+                    T const key = node->key(base + half);
+                    base = (Upper ? !less(value, key) : less(key, value)) ? base + half : base;
+                    count -= half;
+                }
+                T keys[window];
+                node->load_keys(keys, base, count);
+                return base + detail::vector_search<Upper>(keys, count, value);
+            }
+        }
+#endif
+        while (count != 0) {
+            size_t const half = count / 2;
+            T const key = node->key(base + half);
+            if (Upper ? !less(value, key) : less(key, value)) {
+                base += half + 1;
+                count -= half + 1;
+            } else {
+                count = half;
+            }
+        }
+        return base;
+    }
+};
+
+}  // namespace b_tree
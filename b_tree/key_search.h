@@ -0,0 +1,112 @@
+#pragma once
+
+#include <compare>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define B_TREE_AVX2_SEARCH 1
+#include <immintrin.h>
+#endif
+
+namespace b_tree::detail {
+
+// Keys that the vector search below can compare itself: 4 and 8 byte
+// numbers in their natural order.
+template<typename T, typename Comparator>
+inline constexpr bool vector_searchable =
+        (std::same_as<Comparator, std::less<>> || std::same_as<Comparator, std::less<T>>
+         || std::same_as<Comparator, std::compare_three_way>)
+        && (std::is_integral_v<T> || std::is_floating_point_v<T>) && !std::same_as<T, bool>
+        && (sizeof(T) == 4 || sizeof(T) == 8) && !std::same_as<T, long double>;
+
+// Starts loading the cache lines of [data, data + bytes).
+inline void prefetch([[maybe_unused]] void const *data, [[maybe_unused]] size_t bytes) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    auto const *first = static_cast<char const *>(data);
+    for (size_t offset = 0; offset < bytes; offset += 64) {
+        __builtin_prefetch(first + offset);
+    }
+#endif
+}
+
+#ifdef B_TREE_AVX2_SEARCH
+
+inline bool const cpu_has_avx2 = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+}();
+
+// The number of the 32 bytes of keys at from that are less than value, or
+// not greater than it for Upper.
+template<bool Upper, typename T>
+[[gnu::target("avx2")]] inline size_t count_lanes(T const *from, T value) noexcept {
+    if constexpr (std::is_floating_point_v<T>) {
+        if constexpr (sizeof(T) == 4) {
+            __m256 const keys = _mm256_loadu_ps(from);
+            __m256 const mask = _mm256_cmp_ps(keys, _mm256_set1_ps(value), Upper ? _CMP_LE_OQ : _CMP_LT_OQ);
+            return __builtin_popcount(_mm256_movemask_ps(mask));
+        } else {
+            __m256d const keys = _mm256_loadu_pd(from);
+            __m256d const mask = _mm256_cmp_pd(keys, _mm256_set1_pd(value), Upper ? _CMP_LE_OQ : _CMP_LT_OQ);
+            return __builtin_popcount(_mm256_movemask_pd(mask));
+        }
+    } else {
+        // Signed compares only, so unsigned keys get their top bit flipped.
+        __m256i keys = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(from));
+        __m256i probe;
+        if constexpr (sizeof(T) == 4) {
+            probe = _mm256_set1_epi32(static_cast<int32_t>(value));
+            if constexpr (std::is_unsigned_v<T>) {
+                __m256i const flip = _mm256_set1_epi32(INT32_MIN);
+                keys = _mm256_xor_si256(keys, flip);
+                probe = _mm256_xor_si256(probe, flip);
+            }
+        } else {
+            probe = _mm256_set1_epi64x(static_cast<int64_t>(value));
+            if constexpr (std::is_unsigned_v<T>) {
+                __m256i const flip = _mm256_set1_epi64x(INT64_MIN);
+                keys = _mm256_xor_si256(keys, flip);
+                probe = _mm256_xor_si256(probe, flip);
+            }
+        }
+        __m256i const mask = sizeof(T) == 4
+                             ? (Upper ? _mm256_cmpgt_epi32(keys, probe) : _mm256_cmpgt_epi32(probe, keys))
+                             : (Upper ? _mm256_cmpgt_epi64(keys, probe) : _mm256_cmpgt_epi64(probe, keys));
+        // For Upper that counted the greater keys.
+        auto const bits = static_cast<unsigned>(_mm256_movemask_epi8(mask));
+        size_t const matching = __builtin_popcount(bits) / sizeof(T);
+        return Upper ? 32 / sizeof(T) - matching : matching;
+    }
+}
+
+// The index of the first key not less than value (greater than value for
+// Upper) among count sorted keys. Branch-free halving narrows the keys
+// down to a cache line, which a few vector compares then count through.
+template<bool Upper, typename T>
+[[gnu::target("avx2")]] inline size_t vector_search(T const *keys, size_t count, T value) noexcept {
+    constexpr size_t window = 64 / sizeof(T);
+    constexpr size_t lanes = 32 / sizeof(T);
+    T const *base = keys;
+    while (count > window) {
+        size_t const half = count / 2;
+        bool const before = Upper ? !(value < base[half]) : base[half] < value;
+        base = before ? base + half : base;
+        count -= half;
+    }
+    size_t index = base - keys;
+    for (; count >= lanes; count -= lanes, base += lanes) {
+        index += count_lanes<Upper>(base, value);
+    }
+    for (; count != 0; --count, ++base) {
+        index += Upper ? !(value < *base) : *base < value;
+    }
+    return index;
+}
+
+#endif
+
+}  // namespace b_tree::detail
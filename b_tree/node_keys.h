@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace b_tree {
+
+// Keys the trees may move around their nodes with memmove, leaving the old
+// bytes behind without destroying them. True for trivially copyable types;
+// specialize it for types that are not but survive being moved bit by bit,
+// which most types holding only pointers to other memory do, e.g.
+//
+//     template<>
+//     struct b_tree::is_trivially_relocatable<MyKey> : std::true_type {};
+template<typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+template<typename T>
+inline constexpr bool is_trivially_relocatable_v = is_trivially_relocatable<T>::value;
+
+}  // namespace b_tree
+
+namespace b_tree::detail {
+
+// Move-constructs count objects at to from the ones at from and destroys
+// the latter. The ranges may overlap. Moving is expected not to throw.
+template<typename T>
+void relocate(T *to, T *from, size_t count) noexcept {
+    if constexpr (is_trivially_relocatable_v<T>) {
+        std::memmove(static_cast<void *>(to), static_cast<void const *>(from), count * sizeof(T));
+    } else if (to < from) {
+        for (size_t i = 0; i < count; ++i) {
+            std::construct_at(to + i, std::move(from[i]));
+            std::destroy_at(from + i);
+        }
+    } else {
+        for (size_t i = count; i > 0; --i) {
+            std::construct_at(to + i - 1, std::move(from[i - 1]));
+            std::destroy_at(from + i - 1);
+        }
+    }
+}
+
+// The sorted key array at the start of every node of BTree, BPlusTree and
+// BTreeMap, along with the level that tells leaves from internal nodes. Only
+// keys_[0, key_num_) are alive, the rest of the slots are raw storage, and
+// the shifting below keeps it that way.
+template<typename T, size_t Capacity>
+struct NodeKeys {
+    NodeKeys() noexcept: key_num_(), level_() {}
+
+    NodeKeys(NodeKeys const &) = delete;
+
+    NodeKeys &operator=(NodeKeys const &) = delete;
+
+    ~NodeKeys() {
+        std::destroy_n(keys_, key_num_);
+    }
+
+    [[nodiscard]] bool is_full() const noexcept {
+        return key_num_ == Capacity;
+    }
+
+    [[nodiscard]] bool is_leaf_node() const noexcept {
+        return level_ == 0;
+    }
+
+    [[nodiscard]] bool is_internal_node() const noexcept {
+        return level_ != 0;
+    }
+
+    template<typename U>
+    void insert_key(size_t index, U &&value) {
+        open_gap(index);
+        try {
+            std::construct_at(keys_ + index, std::forward<U>(value));
+        } catch (...) {
+            close_gap(index);
+            throw;
+        }
+    }
+
+    void remove_key(size_t index) noexcept {
+        std::destroy_at(keys_ + index);
+        close_gap(index);
+    }
+
+    // Moves keys [index, key_num_) one slot to the right and counts the
+    // now uninitialized slot at index as a key.
+    void open_gap(size_t index) noexcept {
+        assert(index <= key_num_ && key_num_ < Capacity);
+        relocate(keys_ + index + 1, keys_ + index, key_num_ - index);
+        ++key_num_;
+    }
+
+    // Moves keys (index, key_num_) one slot to the left over the
+    // uninitialized slot at index.
+    void close_gap(size_t index) noexcept {
+        assert(index < key_num_);
+        relocate(keys_ + index, keys_ + index + 1, key_num_ - index - 1);
+        --key_num_;
+    }
+
+    static void relocate(T *to, T *from, size_t count) noexcept {
+        detail::relocate(to, from, count);
+    }
+
+    void copy_keys(NodeKeys const *other) {
+        for (; key_num_ < other->key_num_; ++key_num_) {
+            std::construct_at(keys_ + key_num_, other->keys_[key_num_]);
+        }
+    }
+
+    size_t key_num_;
+    std::uint8_t level_;
+    union {
+        T keys_[Capacity];
+    };
+};
+
+}  // namespace b_tree::detail
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace b_tree {
+
+// Hands out fixed-size blocks carved from big chunks and keeps freed
+// blocks on a free list per block size, so that nodes freed by merges are
+// reused by the next splits. A B-tree only ever asks for a couple of
+// sizes (one per node layout). Not thread-safe.
+class NodePool {
+public:
+    NodePool() = default;
+
+    NodePool(NodePool const &) = delete;
+
+    NodePool &operator=(NodePool const &) = delete;
+
+    ~NodePool() {
+        release();
+    }
+
+    [[nodiscard]] void *allocate(size_t size, size_t alignment) {
+        SizeClass &size_class = get_size_class(size, alignment);
+        if (size_class.free != nullptr) {
+            FreeBlock *block = size_class.free;
+            size_class.free = block->next;
+            return block;
+        }
+        if (size_class.cursor == size_class.end) {
+            add_chunk(size_class);
+        }
+        void *block = size_class.cursor;
+        size_class.cursor += size_class.block_size;
+        return block;
+    }
+
+    void deallocate(void *block, size_t size, size_t alignment) noexcept {
+        SizeClass &size_class = find_size_class(size, alignment);
+        size_class.free = ::new(block) FreeBlock{size_class.free};
+    }
+
+    // Frees all the memory at once, blocks still in use included.
+    void release() noexcept {
+        while (chunks_ != nullptr) {
+            Chunk *next = chunks_->next;
+            ::operator delete(chunks_, chunks_->bytes, std::align_val_t(chunks_->alignment));
+            chunks_ = next;
+        }
+        for (auto &size_class: size_classes_) {
+            size_class.free = nullptr;
+            size_class.cursor = size_class.end = nullptr;
+            size_class.chunk_blocks = first_chunk_blocks;
+        }
+    }
+
+private:
+    static constexpr size_t first_chunk_blocks = 16;
+    static constexpr size_t max_chunk_blocks = 4096;
+
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    struct Chunk {
+        Chunk *next;
+        size_t bytes;
+        size_t alignment;
+    };
+
+    struct SizeClass {
+        size_t size;
+        size_t alignment;
+        size_t block_size;
+        size_t chunk_blocks = first_chunk_blocks;
+        FreeBlock *free = nullptr;
+        std::byte *cursor = nullptr;
+        std::byte *end = nullptr;
+    };
+
+    static size_t round_up(size_t size, size_t alignment) noexcept {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    SizeClass &get_size_class(size_t size, size_t alignment) {
+        for (auto &size_class: size_classes_) {
+            if (size_class.size == size && size_class.alignment == alignment) return size_class;
+        }
+        size_t const block_alignment = std::max(alignment, alignof(FreeBlock));
+        size_t const block_size = round_up(std::max(size, sizeof(FreeBlock)), block_alignment);
+        return size_classes_.emplace_back(SizeClass{size, alignment, block_size});
+    }
+
+    SizeClass &find_size_class(size_t size, size_t alignment) noexcept {
+        for (auto &size_class: size_classes_) {
+            if (size_class.size == size && size_class.alignment == alignment) return size_class;
+        }
+        assert(false && "block was not allocated by this pool");
+        return size_classes_.front();
+    }
+
+    void add_chunk(SizeClass &size_class) {
+        size_t const alignment = std::max(size_class.alignment, alignof(Chunk));
+        size_t const header = round_up(sizeof(Chunk), alignment);
+        size_t const bytes = header + size_class.block_size * size_class.chunk_blocks;
+        auto *memory = static_cast<std::byte *>(::operator new(bytes, std::align_val_t(alignment)));
+        chunks_ = ::new(memory) Chunk{chunks_, bytes, alignment};
+        size_class.cursor = memory + header;
+        size_class.end = memory + bytes;
+        size_class.chunk_blocks = std::min(size_class.chunk_blocks * 2, max_chunk_blocks);
+    }
+
+    std::vector<SizeClass> size_classes_;
+    Chunk *chunks_ = nullptr;
+};
+
+// Allocates single objects (B-tree nodes) from a NodePool shared by all
+// copies of the allocator. A default-constructed allocator makes a new
+// pool, and so does copying a BTree, which makes each tree own its pool
+// unless an allocator is explicitly passed to several trees.
+template<typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    PoolAllocator() : pool_(std::make_shared<NodePool>()) {}
+
+    template<typename U>
+    PoolAllocator(PoolAllocator<U> const &other) noexcept : pool_(other.pool_) {}  // NOLINT(google-explicit-constructor)
+
+    [[nodiscard]] T *allocate(size_t n) {
+        if (n != 1) return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+        return static_cast<T *>(pool_->allocate(sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t n) noexcept {
+        if (n != 1) ::operator delete(p, n * sizeof(T), std::align_val_t(alignof(T)));
+        else pool_->deallocate(p, sizeof(T), alignof(T));
+    }
+
+    [[nodiscard]] PoolAllocator select_on_container_copy_construction() const {
+        return {};
+    }
+
+    // Frees everything allocated from the pool at once, without running
+    // any destructors. Refuses to when other allocators share the pool.
+    bool release() noexcept {
+        if (pool_.use_count() != 1) return false;
+        pool_->release();
+        return true;
+    }
+
+    friend bool operator==(PoolAllocator const &a, PoolAllocator const &b) noexcept {
+        return a.pool_ == b.pool_;
+    }
+
+private:
+    std::shared_ptr<NodePool> pool_;
+
+    template<typename U>
+    friend class PoolAllocator;
+};
+
+}  // namespace b_tree
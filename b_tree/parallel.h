@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace b_tree {
+
+// Asks for an operation to be spread over threads: as many as the hardware
+// runs at once, or threads if that is not 0. The calling thread is one of
+// them.
+struct parallel_t {
+    unsigned threads = 0;
+};
+
+inline constexpr parallel_t parallel{};
+
+}  // namespace b_tree
+
+namespace b_tree::detail {
+
+[[nodiscard]] inline size_t thread_count(parallel_t execution) noexcept {
+    if (execution.threads != 0) return execution.threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// How many pieces to cut work into for the threads of execution, a few per
+// thread so that uneven pieces even out.
+[[nodiscard]] inline size_t task_count(parallel_t execution) noexcept {
+    return thread_count(execution) * 4;
+}
+
+// Runs task(i) for every i in [0, count), handing the indices out one at a
+// time to the threads of execution. Once a task throws, the ones not
+// started yet are skipped, and the exception is rethrown when all threads
+// are done. Threads that cannot be started leave more work to the others.
+template<typename Task>
+void parallel_for(parallel_t execution, size_t count, Task const &task) {
+    if (count == 0) return;
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto const work = [&] {
+        for (size_t i; !failed.load(std::memory_order_relaxed) && (i = next++) < count;) {
+            try {
+                task(i);
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (!error) error = std::current_exception();
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::jthread> threads;
+    try {
+        size_t const helpers = std::min(thread_count(execution), count) - 1;
+        threads.reserve(helpers);
+        while (threads.size() < helpers) {
+            threads.emplace_back(work);
+        }
+    } catch (std::system_error const &) {
+    } catch (std::bad_alloc const &) {
+    }
+    work();
+    threads.clear();
+    if (error) std::rethrow_exception(error);
+}
+
+}  // namespace b_tree::detail
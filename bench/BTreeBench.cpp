@@ -0,0 +1,749 @@
+// Benchmarks BTree and BPlusTree against std::multiset (std::set would drop
+// the duplicates the Zipfian streams produce, the trees keep them).
+// ConcurrentBTree gets a mixed workload run from 1 up to as many threads as
+// there are cores, against a BTree behind a std::shared_mutex.
+//
+// Every benchmark is named <container>/<key>/<operation>/<stream>/<elements>
+// and reports time/op. Building benchmarks also report bytes/element (all heap
+// memory the container holds, counted by the operator new below) and, when
+// the kernel lets us open a hardware counter, cache-misses/op.
+//
+// Configure with -DCMAKE_BUILD_TYPE=Release and run a subset with e.g.
+// --benchmark_filter='BTree<64>/size_t/contains'.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "benchmark/benchmark.h"
+#include "b_plus_tree.h"
+#include "b_tree.h"
+#include "concurrent_b_tree.h"
+#include "node_pool.h"
+
+// Allocation accounting
+
+namespace {
+
+std::atomic<size_t> allocated_bytes{0};
+
+// Keeps the requested size in front of every block so that unsized
+// operator delete can account for it too.
+constexpr size_t header_size = alignof(std::max_align_t);
+
+void *counted_alloc(size_t size, size_t alignment) {
+    size_t const header = std::max(header_size, alignment);
+    void *raw = std::aligned_alloc(header, (size + 2 * header - 1) / header * header);
+    if (raw == nullptr) throw std::bad_alloc();
+    auto *block = static_cast<std::byte *>(raw) + header;
+    std::memcpy(block - sizeof(size_t), &size, sizeof(size_t));
+    std::memcpy(block - 2 * sizeof(size_t), &header, sizeof(size_t));
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    return block;
+}
+
+void counted_free(void *ptr) noexcept {
+    if (ptr == nullptr) return;
+    auto *block = static_cast<std::byte *>(ptr);
+    size_t size;
+    size_t header;
+    std::memcpy(&size, block - sizeof(size_t), sizeof(size_t));
+    std::memcpy(&header, block - 2 * sizeof(size_t), sizeof(size_t));
+    allocated_bytes.fetch_sub(size, std::memory_order_relaxed);
+    std::free(block - header);
+}
+
+}  // namespace
+
+void *operator new(size_t size) { return counted_alloc(size, header_size); }
+
+void *operator new[](size_t size) { return counted_alloc(size, header_size); }
+
+void *operator new(size_t size, std::align_val_t al) { return counted_alloc(size, static_cast<size_t>(al)); }
+
+void *operator new[](size_t size, std::align_val_t al) { return counted_alloc(size, static_cast<size_t>(al)); }
+
+void operator delete(void *ptr) noexcept { counted_free(ptr); }
+
+void operator delete[](void *ptr) noexcept { counted_free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { counted_free(ptr); }
+
+void operator delete[](void *ptr, size_t) noexcept { counted_free(ptr); }
+
+void operator delete(void *ptr, std::align_val_t) noexcept { counted_free(ptr); }
+
+void operator delete[](void *ptr, std::align_val_t) noexcept { counted_free(ptr); }
+
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept { counted_free(ptr); }
+
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept { counted_free(ptr); }
+
+namespace {
+
+// Cache misses
+
+class CacheMissCounter {
+public:
+    CacheMissCounter() {
+#if defined(__linux__)
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    CacheMissCounter(CacheMissCounter const &) = delete;
+
+    CacheMissCounter &operator=(CacheMissCounter const &) = delete;
+
+    ~CacheMissCounter() {
+#if defined(__linux__)
+        if (fd_ != -1) close(fd_);
+#endif
+    }
+
+    [[nodiscard]] bool available() const noexcept { return fd_ != -1; }
+
+    void start() noexcept {
+#if defined(__linux__)
+        if (fd_ == -1) return;
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    void stop() noexcept {
+#if defined(__linux__)
+        if (fd_ == -1) return;
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        long long value = 0;
+        if (read(fd_, &value, sizeof(value)) == sizeof(value)) total_ += value;
+#endif
+    }
+
+    [[nodiscard]] long long total() const noexcept { return total_; }
+
+private:
+    int fd_ = -1;
+    long long total_ = 0;
+};
+
+// Key streams
+
+enum class Stream {
+    Sequential,
+    Random,
+    Zipfian,
+};
+
+char const *to_string(Stream stream) {
+    switch (stream) {
+        case Stream::Sequential:
+            return "sequential";
+        case Stream::Random:
+            return "random";
+        case Stream::Zipfian:
+            return "zipfian";
+    }
+    return "";
+}
+
+// Gray et al., "Quickly generating billion-record synthetic databases",
+// as used by YCSB. Rank 0 is the most popular item.
+class ZipfianGenerator {
+public:
+    explicit ZipfianGenerator(size_t items, double theta = 0.99) : items_(items), theta_(theta) {
+        for (size_t i = 1; i <= items_; ++i) {
+            zeta_n_ += 1.0 / std::pow(static_cast<double>(i), theta_);
+        }
+        double const zeta_2 = 1.0 + 1.0 / std::pow(2.0, theta_);
+        alpha_ = 1.0 / (1.0 - theta_);
+        eta_ = (1.0 - std::pow(2.0 / static_cast<double>(items_), 1.0 - theta_)) / (1.0 - zeta_2 / zeta_n_);
+    }
+
+    template<typename Engine>
+    size_t operator()(Engine &engine) {
+        double const u = std::uniform_real_distribution<double>(0.0, 1.0)(engine);
+        double const uz = u * zeta_n_;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + std::pow(0.5, theta_)) return 1;
+        auto const rank = static_cast<size_t>(static_cast<double>(items_) * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+        return std::min(rank, items_ - 1);
+    }
+
+private:
+    size_t items_;
+    double theta_;
+    double zeta_n_ = 0.0;
+    double alpha_;
+    double eta_;
+};
+
+// Element ids in the order the stream produces them. Random streams are a
+// permutation, Zipfian ones repeat popular ids (scattered so that popular
+// keys are not all neighbours).
+std::vector<size_t> make_ids(Stream stream, size_t count, uint64_t seed) {
+    std::vector<size_t> ids(count);
+    std::mt19937_64 engine(seed);
+    switch (stream) {
+        case Stream::Sequential:
+            for (size_t i = 0; i < count; ++i) ids[i] = i;
+            break;
+        case Stream::Random:
+            for (size_t i = 0; i < count; ++i) ids[i] = i;
+            std::shuffle(ids.begin(), ids.end(), engine);
+            break;
+        case Stream::Zipfian: {
+            std::vector<size_t> scatter(count);
+            for (size_t i = 0; i < count; ++i) scatter[i] = i;
+            std::shuffle(scatter.begin(), scatter.end(), engine);
+            ZipfianGenerator zipf(count);
+            for (auto &id: ids) id = scatter[zipf(engine)];
+            break;
+        }
+    }
+    return ids;
+}
+
+template<typename Key>
+struct KeyMaker;
+
+template<>
+struct KeyMaker<size_t> {
+    static constexpr char const *name = "size_t";
+
+    // Spread ids so that lookups of id + 1 miss.
+    static size_t make(size_t id) { return id * 2; }
+};
+
+template<>
+struct KeyMaker<std::string> {
+    static constexpr char const *name = "string";
+
+    // Long enough to not fit into the small string buffer, with a shared
+    // prefix so that comparisons have to look past it.
+    static std::string make(size_t id) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "key:%020zu", id * 2);
+        return buffer;
+    }
+};
+
+template<typename Key>
+std::vector<Key> make_keys(Stream stream, size_t count, uint64_t seed) {
+    std::vector<Key> keys;
+    keys.reserve(count);
+    for (size_t id: make_ids(stream, count, seed)) {
+        keys.emplace_back(KeyMaker<Key>::make(id));
+    }
+    return keys;
+}
+
+// Containers
+
+template<size_t Order, template<typename> typename Allocator = std::allocator, typename Policy = b_tree::default_policy>
+struct BTreeOf {
+    template<typename Key>
+    using type = b_tree::BTree<Key, Order, std::less<>, Allocator<Key>, Policy>;
+
+    static std::string name() {
+        std::string name = "BTree<" + std::to_string(Order);
+        if constexpr (std::is_same_v<Allocator<int>, b_tree::PoolAllocator<int>>) name += ",pool";
+        if constexpr (std::is_same_v<Policy, b_tree::cache_line_policy>) name += ",cache_line";
+        if constexpr (std::is_same_v<Policy, b_tree::copy_on_write_policy>) name += ",copy_on_write";
+        return name + ">";
+    }
+
+    template<typename Key>
+    static void remove(type<Key> &tree, Key const &key) { tree.remove(key); }
+
+    template<typename Key>
+    static type<Key> build_sorted(std::vector<Key> const &keys) {
+        return type<Key>(b_tree::from_sorted, keys.begin(), keys.end());
+    }
+
+    template<typename Key>
+    static void insert_batch(type<Key> &tree, std::vector<Key> const &batch) { tree.insert_batch(batch); }
+};
+
+// No bulk operations, those go one key at a time.
+template<size_t Order>
+struct BPlusTreeOf {
+    template<typename Key>
+    using type = b_tree::BPlusTree<Key, Order>;
+
+    static std::string name() { return "BPlusTree<" + std::to_string(Order) + ">"; }
+
+    template<typename Key>
+    static void remove(type<Key> &tree, Key const &key) { tree.remove(key); }
+
+    template<typename Key>
+    static type<Key> build_sorted(std::vector<Key> const &keys) {
+        type<Key> tree;
+        for (auto const &key: keys) {
+            tree.insert(key);
+        }
+        return tree;
+    }
+
+    template<typename Key>
+    static void insert_batch(type<Key> &tree, std::vector<Key> const &batch) {
+        for (auto const &key: batch) {
+            tree.insert(key);
+        }
+    }
+};
+
+struct MultisetOf {
+    template<typename Key>
+    using type = std::multiset<Key, std::less<>>;
+
+    static std::string name() { return "std::multiset"; }
+
+    template<typename Key>
+    static void remove(type<Key> &set, Key const &key) {
+        auto it = set.find(key);
+        if (it != set.end()) set.erase(it);
+    }
+
+    // Linear for sorted input.
+    template<typename Key>
+    static type<Key> build_sorted(std::vector<Key> const &keys) {
+        return type<Key>(keys.begin(), keys.end());
+    }
+
+    // Hinted with the previous position, which is cheap for sorted input.
+    template<typename Key>
+    static void insert_batch(type<Key> &set, std::vector<Key> const &batch) {
+        auto hint = set.begin();
+        for (auto const &key: batch) {
+            hint = std::next(set.insert(hint, key));
+        }
+    }
+};
+
+void set_per_op(benchmark::State &state, size_t ops_per_iteration) {
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * ops_per_iteration));
+    state.counters["time/op"] = benchmark::Counter(static_cast<double>(ops_per_iteration),
+                                                 benchmark::Counter::kIsIterationInvariantRate
+                                                 | benchmark::Counter::kInvert);
+}
+
+void set_cache_misses(benchmark::State &state, CacheMissCounter const &misses, size_t ops) {
+    if (!misses.available() || state.iterations() == 0) return;
+    state.counters["cache-misses/op"] = static_cast<double>(misses.total())
+                                        / static_cast<double>(state.iterations() * ops);
+}
+
+template<typename Container, typename Key>
+void bm_insert(benchmark::State &state, Stream stream) {
+    using Set = typename Container::template type<Key>;
+    auto const count = static_cast<size_t>(state.range(0));
+    auto const keys = make_keys<Key>(stream, count, 1);
+    CacheMissCounter misses;
+    size_t bytes = 0;
+    for (auto _: state) {
+        size_t const before = allocated_bytes.load(std::memory_order_relaxed);
+        Set set;
+        misses.start();
+        for (auto const &key: keys) {
+            set.insert(key);
+        }
+        misses.stop();
+        bytes = allocated_bytes.load(std::memory_order_relaxed) - before;
+        benchmark::DoNotOptimize(set);
+        state.PauseTiming();
+        {
+            Set destroyed = std::move(set);
+        }
+        state.ResumeTiming();
+    }
+    set_per_op(state, count);
+    set_cache_misses(state, misses, count);
+    state.counters["bytes/element"] = static_cast<double>(bytes) / static_cast<double>(count);
+}
+
+// Builds the container from sorted keys, BTree through its bulk load.
+template<typename Container, typename Key>
+void bm_build_sorted(benchmark::State &state, Stream stream) {
+    using Set = typename Container::template type<Key>;
+    auto const count = static_cast<size_t>(state.range(0));
+    auto keys = make_keys<Key>(stream, count, 1);
+    std::sort(keys.begin(), keys.end());
+    CacheMissCounter misses;
+    size_t bytes = 0;
+    for (auto _: state) {
+        size_t const before = allocated_bytes.load(std::memory_order_relaxed);
+        misses.start();
+        Set set = Container::build_sorted(keys);
+        misses.stop();
+        bytes = allocated_bytes.load(std::memory_order_relaxed) - before;
+        benchmark::DoNotOptimize(set);
+        state.PauseTiming();
+        {
+            Set destroyed = std::move(set);
+        }
+        state.ResumeTiming();
+    }
+    set_per_op(state, count);
+    set_cache_misses(state, misses, count);
+    state.counters["bytes/element"] = static_cast<double>(bytes) / static_cast<double>(count);
+}
+
+// Inserts the keys in sorted batches.
+template<typename Container, typename Key>
+void bm_insert_batch(benchmark::State &state, Stream stream) {
+    using Set = typename Container::template type<Key>;
+    constexpr size_t batch_size = 1024;
+    auto const count = static_cast<size_t>(state.range(0));
+    auto const keys = make_keys<Key>(stream, count, 1);
+    std::vector<std::vector<Key>> batches;
+    for (size_t i = 0; i < count; i += batch_size) {
+        auto &batch = batches.emplace_back(keys.begin() + i, keys.begin() + std::min(i + batch_size, count));
+        std::sort(batch.begin(), batch.end());
+    }
+    CacheMissCounter misses;
+    for (auto _: state) {
+        Set set;
+        misses.start();
+        for (auto const &batch: batches) {
+            Container::insert_batch(set, batch);
+        }
+        misses.stop();
+        benchmark::DoNotOptimize(set);
+        state.PauseTiming();
+        {
+            Set destroyed = std::move(set);
+        }
+        state.ResumeTiming();
+    }
+    set_per_op(state, count);
+    set_cache_misses(state, misses, count);
+}
+
+template<typename Container, typename Key>
+void bm_contains(benchmark::State &state, Stream stream) {
+    using Set = typename Container::template type<Key>;
+    auto const count = static_cast<size_t>(state.range(0));
+    Set set;
+    for (auto const &key: make_keys<Key>(Stream::Random, count, 1)) {
+        set.insert(key);
+    }
+    // Half of the probes hit, the odd ids miss.
+    std::vector<Key> probes;
+    probes.reserve(count);
+    for (size_t id: make_ids(stream, count, 2)) {
+        probes.emplace_back(KeyMaker<Key>::make(id / 2 + id % 2 * count));
+    }
+    CacheMissCounter misses;
+    for (auto _: state) {
+        misses.start();
+        for (auto const &probe: probes) {
+            benchmark::DoNotOptimize(set.contains(probe));
+        }
+        misses.stop();
+    }
+    set_per_op(state, count);
+    set_cache_misses(state, misses, count);
+}
+
+template<typename Container, typename Key>
+void bm_find(benchmark::State &state, Stream stream) {
+    using Set = typename Container::template type<Key>;
+    auto const count = static_cast<size_t>(state.range(0));
+    Set set;
+    for (auto const &key: make_keys<Key>(Stream::Random, count, 1)) {
+        set.insert(key);
+    }
+    auto const probes = make_keys<Key>(stream, count, 2);
+    CacheMissCounter misses;
+    for (auto _: state) {
+        misses.start();
+        for (auto const &probe: probes) {
+            auto it = set.find(probe);
+            benchmark::DoNotOptimize(*it);
+        }
+        misses.stop();
+    }
+    set_per_op(state, count);
+    set_cache_misses(state, misses, count);
+}
+
+// Reads the 16 keys from the lower bound of each probe on, the way a time
+// window query would.
+template<typename Container, typename Key>
+void bm_range_scan(benchmark::State &state, Stream stream) {
+    using Set = typename Container::template type<Key>;
+    constexpr size_t scan_length = 16;
+    auto const count = static_cast<size_t>(state.range(0));
+    Set set;
+    for (auto const &key: make_keys<Key>(Stream::Random, count, 1)) {
+        set.insert(key);
+    }
+    auto const probes = make_keys<Key>(stream, count, 2);
+    CacheMissCounter misses;
+    for (auto _: state) {
+        misses.start();
+        for (auto const &probe: probes) {
+            auto it = set.lower_bound(probe);
+            for (size_t i = 0; i < scan_length && it != set.end(); ++i, ++it) {
+                benchmark::DoNotOptimize(*it);
+            }
+        }
+        misses.stop();
+    }
+    set_per_op(state, count);
+    set_cache_misses(state, misses, count);
+}
+
+template<typename Container, typename Key>
+void bm_remove(benchmark::State &state, Stream stream) {
+    using Set = typename Container::template type<Key>;
+    auto const count = static_cast<size_t>(state.range(0));
+    auto const keys = make_keys<Key>(Stream::Random, count, 1);
+    auto const removed = make_keys<Key>(stream, count, 2);
+    CacheMissCounter misses;
+    for (auto _: state) {
+        state.PauseTiming();
+        Set set;
+        for (auto const &key: keys) {
+            set.insert(key);
+        }
+        state.ResumeTiming();
+        misses.start();
+        for (auto const &key: removed) {
+            Container::remove(set, key);
+        }
+        misses.stop();
+        benchmark::DoNotOptimize(set);
+        state.PauseTiming();
+        {
+            Set destroyed = std::move(set);
+        }
+        state.ResumeTiming();
+    }
+    set_per_op(state, count);
+    set_cache_misses(state, misses, count);
+}
+
+template<typename Container, typename Key>
+void bm_iterate(benchmark::State &state, Stream stream) {
+    using Set = typename Container::template type<Key>;
+    auto const count = static_cast<size_t>(state.range(0));
+    Set set;
+    for (auto const &key: make_keys<Key>(stream, count, 1)) {
+        set.insert(key);
+    }
+    CacheMissCounter misses;
+    size_t visited = 0;
+    for (auto _: state) {
+        misses.start();
+        visited = 0;
+        for (auto it = set.begin(); it != set.end(); ++it) {
+            benchmark::DoNotOptimize(*it);
+            ++visited;
+        }
+        misses.stop();
+    }
+    set_per_op(state, visited);
+    set_cache_misses(state, misses, visited);
+}
+
+// Copies the container and inserts a key into the copy, which is where
+// copy-on-write trees copy what they have to. Reports bytes/element of the
+// copy, and time/op per key of the container like the others.
+template<typename Container, typename Key>
+void bm_copy(benchmark::State &state, Stream stream) {
+    using Set = typename Container::template type<Key>;
+    auto const count = static_cast<size_t>(state.range(0));
+    auto const keys = make_keys<Key>(stream, count, 1);
+    Set set;
+    for (auto const &key: keys) {
+        set.insert(key);
+    }
+    CacheMissCounter misses;
+    size_t bytes = 0;
+    for (auto _: state) {
+        size_t const before = allocated_bytes.load(std::memory_order_relaxed);
+        misses.start();
+        Set copy = set;
+        copy.insert(keys.front());
+        misses.stop();
+        bytes = allocated_bytes.load(std::memory_order_relaxed) - before;
+        benchmark::DoNotOptimize(copy);
+        state.PauseTiming();
+        {
+            Set destroyed = std::move(copy);
+        }
+        state.ResumeTiming();
+    }
+    set_per_op(state, count);
+    set_cache_misses(state, misses, count);
+    state.counters["bytes/element"] = static_cast<double>(bytes) / static_cast<double>(count);
+}
+
+// Concurrency
+
+// How BTree gets shared between threads without ConcurrentBTree.
+struct LockedBTree {
+    static std::string name() { return "BTree<64>+shared_mutex"; }
+
+    bool contains(size_t key) const {
+        std::shared_lock lock(mutex);
+        return tree.contains(key);
+    }
+
+    void insert(size_t key) {
+        std::unique_lock lock(mutex);
+        if (!tree.contains(key)) tree.insert(key);
+    }
+
+    void remove(size_t key) {
+        std::unique_lock lock(mutex);
+        tree.remove(key);
+    }
+
+    mutable std::shared_mutex mutex;
+    b_tree::BTree<size_t, 64> tree;
+};
+
+struct ConcurrentBTreeOf64 {
+    static std::string name() { return "ConcurrentBTree<64>"; }
+
+    bool contains(size_t key) const { return tree.contains(key); }
+
+    void insert(size_t key) { tree.insert(key); }
+
+    void remove(size_t key) { tree.remove(key); }
+
+    b_tree::ConcurrentBTree<size_t, 64> tree;
+};
+
+// All threads work on one set that starts out with every other key, each
+// running its own random stream of 90% lookups, 5% inserts and 5% removes.
+// time/op is wall time over the operations of all threads together.
+template<typename Set>
+void bm_concurrent_mixed(benchmark::State &state) {
+    static Set *set = nullptr;
+    constexpr size_t ops_per_iteration = 1024;
+    auto const count = static_cast<size_t>(state.range(0));
+    if (state.thread_index() == 0) {
+        set = new Set();
+        for (size_t id: make_ids(Stream::Random, count, 1)) {
+            set->insert(KeyMaker<size_t>::make(id));
+        }
+    }
+    auto const ids = make_ids(Stream::Random, count * 2, 2 + state.thread_index());
+    size_t next = 0;
+    for (auto _: state) {
+        for (size_t i = 0; i < ops_per_iteration; ++i, next = next + 1 == ids.size() ? 0 : next + 1) {
+            size_t const key = ids[next];
+            switch (next % 20) {
+                case 0:
+                    set->insert(key);
+                    break;
+                case 1:
+                    set->remove(key);
+                    break;
+                default:
+                    benchmark::DoNotOptimize(set->contains(key));
+            }
+        }
+    }
+    set_per_op(state, ops_per_iteration);
+    if (state.thread_index() == 0) {
+        delete set;
+        set = nullptr;
+    }
+}
+
+template<typename Set>
+void register_concurrent() {
+    std::string const name = Set::name() + "/size_t/mixed/random";
+    benchmark::RegisterBenchmark(name.c_str(), bm_concurrent_mixed<Set>)
+            ->Arg(1 << 20)
+            ->ThreadRange(1, static_cast<int>(std::max(1u, std::thread::hardware_concurrency())))
+            ->UseRealTime()
+            ->Unit(benchmark::kMillisecond);
+}
+
+template<typename Container, typename Key>
+void register_container() {
+    using Benchmark = void (*)(benchmark::State &, Stream);
+    struct Operation {
+        char const *name;
+        Benchmark run;
+    };
+    Operation const operations[] = {
+            {"insert",   bm_insert<Container, Key>},
+            {"build_sorted", bm_build_sorted<Container, Key>},
+            {"insert_batch", bm_insert_batch<Container, Key>},
+            {"contains", bm_contains<Container, Key>},
+            {"find",     bm_find<Container, Key>},
+            {"range_scan", bm_range_scan<Container, Key>},
+            {"remove",   bm_remove<Container, Key>},
+            {"iterate",  bm_iterate<Container, Key>},
+            {"copy",     bm_copy<Container, Key>},
+    };
+    for (auto const &operation: operations) {
+        for (auto stream: {Stream::Sequential, Stream::Random, Stream::Zipfian}) {
+            std::string const name = Container::name() + "/" + KeyMaker<Key>::name + "/" + operation.name + "/"
+                                     + to_string(stream);
+            benchmark::RegisterBenchmark(name.c_str(), operation.run, stream)
+                    ->RangeMultiplier(16)->Range(1 << 12, 1 << 20)
+                    ->Unit(benchmark::kMillisecond);
+        }
+    }
+}
+
+template<typename Key>
+void register_key() {
+    register_container<BTreeOf<2>, Key>();
+    register_container<BTreeOf<16>, Key>();
+    register_container<BTreeOf<64>, Key>();
+    register_container<BTreeOf<128>, Key>();
+    register_container<BTreeOf<64, b_tree::PoolAllocator>, Key>();
+    register_container<BTreeOf<64, std::allocator, b_tree::cache_line_policy>, Key>();
+    register_container<BTreeOf<128, std::allocator, b_tree::cache_line_policy>, Key>();
+    register_container<BTreeOf<64, std::allocator, b_tree::copy_on_write_policy>, Key>();
+    register_container<BPlusTreeOf<64>, Key>();
+    register_container<MultisetOf, Key>();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    register_key<size_t>();
+    register_key<std::string>();
+    register_concurrent<ConcurrentBTreeOf64>();
+    register_concurrent<LockedBTree>();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
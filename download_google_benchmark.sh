@@ -0,0 +1,2 @@
+cd bench/
+git clone https://github.com/google/benchmark.git
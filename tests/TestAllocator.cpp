@@ -0,0 +1,112 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "b_tree.h"
+#include "node_pool.h"
+
+template<typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    explicit CountingAllocator(long *live) : live(live) {}
+
+    template<typename U>
+    CountingAllocator(CountingAllocator<U> const &other) : live(other.live) {}
+
+    T *allocate(size_t n) {
+        ++*live;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *p, size_t n) {
+        --*live;
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    friend bool operator==(CountingAllocator const &a, CountingAllocator const &b) { return a.live == b.live; }
+
+    long *live;
+};
+
+TEST(AllocatorSuite, NodesGoThroughAllocator) {
+    long live = 0;
+    {
+        b_tree::BTree<std::string, 2, std::less<>, CountingAllocator<std::string>> tree{
+                CountingAllocator<std::string>(&live)};
+        for (int i = 0; i < 300; ++i) {
+            tree.insert(std::to_string(i));
+        }
+        EXPECT_GT(live, 50);
+        for (int i = 0; i < 300; i += 2) {
+            tree.remove(std::to_string(i));
+        }
+        auto copy = tree;
+        EXPECT_TRUE(copy.contains("299"));
+        EXPECT_FALSE(copy.contains("298"));
+    }
+    EXPECT_EQ(live, 0);
+}
+
+TEST(AllocatorSuite, PoolTree) {
+    using TreeType = b_tree::BTree<int, 3, std::less<>, b_tree::PoolAllocator<int>>;
+    TreeType tree;
+    for (int i = 0; i < 2000; ++i) {
+        tree.insert(i * 13 % 2000);
+    }
+    for (int i = 0; i < 2000; i += 3) {
+        tree.remove(i);
+    }
+    for (int i = 0; i < 2000; ++i) {
+        EXPECT_EQ(tree.contains(i), i % 3 != 0);
+    }
+
+    TreeType copy = tree;
+    EXPECT_FALSE(copy.get_allocator() == tree.get_allocator());
+    tree.clear();
+    EXPECT_TRUE(tree.empty());
+    for (int i = 0; i < 100; ++i) {
+        tree.insert(i);
+    }
+    EXPECT_TRUE(tree.contains(99));
+    EXPECT_TRUE(copy.contains(1999));
+    EXPECT_FALSE(copy.contains(1998));
+}
+
+TEST(AllocatorSuite, PoolTreeAssignSorted) {
+    b_tree::BTree<int, 3, std::less<>, b_tree::PoolAllocator<int>> tree;
+    std::vector<int> values(1000);
+    for (int i = 0; i < 1000; ++i) {
+        values[i] = i;
+        tree.insert(-i);
+    }
+    tree.assign_sorted(values);
+    EXPECT_TRUE(tree.contains(999));
+    EXPECT_FALSE(tree.contains(-1));
+    tree.insert(1000);
+    EXPECT_TRUE(tree.contains(1000));
+}
+
+TEST(AllocatorSuite, SharedPoolIsNotReleased) {
+    b_tree::PoolAllocator<long> allocator;
+    b_tree::BTree<long, 2, std::less<>, b_tree::PoolAllocator<long>> a{allocator};
+    b_tree::BTree<long, 2, std::less<>, b_tree::PoolAllocator<long>> b{allocator};
+    for (long i = 0; i < 100; ++i) {
+        a.insert(i);
+        b.insert(-i);
+    }
+    a.clear();
+    EXPECT_TRUE(b.contains(-99));
+    EXPECT_TRUE(b.contains(0));
+}
+
+TEST(AllocatorSuite, PoolRecyclesBlocks) {
+    b_tree::NodePool pool;
+    void *first = pool.allocate(40, 8);
+    void *second = pool.allocate(40, 8);
+    EXPECT_NE(first, second);
+    pool.deallocate(first, 40, 8);
+    EXPECT_EQ(pool.allocate(40, 8), first);
+    void *aligned = pool.allocate(256, 64);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % 64, 0);
+}
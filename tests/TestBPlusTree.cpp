@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "b_plus_tree.h"
+#include "test_helpers.h"
+
+namespace {
+
+// Throws on the copy that makes throw_at reach 0, counts live instances.
+struct Fragile {
+    Fragile(int value) : value(value) { ++alive; }  // NOLINT(google-explicit-constructor)
+
+    Fragile(Fragile const &other) : value(other.value) {
+        if (--throw_at == 0) throw std::runtime_error("copy");
+        ++alive;
+    }
+
+    Fragile &operator=(Fragile const &) = default;
+
+    ~Fragile() { --alive; }
+
+    friend bool operator<(Fragile const &a, Fragile const &b) { return a.value < b.value; }
+
+    int value;
+
+    static inline long alive = 0;
+    static inline long throw_at = -1;
+};
+
+}  // namespace
+
+TEST(BPlusTreeSuite, EmptyTree) {
+    b_tree::BPlusTree<int, 2> tree;
+    EXPECT_TRUE(tree.empty());
+    EXPECT_EQ(tree.size(), 0);
+    EXPECT_EQ(tree.begin(), tree.end());
+    EXPECT_EQ(tree.lower_bound(1), tree.end());
+    EXPECT_FALSE(tree.contains(1));
+    EXPECT_FALSE(tree.remove(1));
+}
+
+TEST(BPlusTreeSuite, InsertAndIterate) {
+    b_tree::BPlusTree<int, 2> tree;
+    std::multiset<int> set;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(i * 7919 % 1000);
+        set.insert(i * 7919 % 1000);
+    }
+    expect_same_keys(tree, set);
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_TRUE(tree.contains(i));
+    }
+    EXPECT_FALSE(tree.contains(1000));
+    EXPECT_FALSE(tree.contains(-1));
+}
+
+TEST(BPlusTreeSuite, Bounds) {
+    b_tree::BPlusTree<int, 3> tree;
+    std::multiset<int> set;
+    for (int i = 0; i < 300; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            tree.insert(i * 17 % 300 * 2);
+            set.insert(i * 17 % 300 * 2);
+        }
+    }
+    for (int value = -2; value <= 602; ++value) {
+        EXPECT_EQ(std::distance(tree.lower_bound(value), tree.end()),
+                  std::distance(set.lower_bound(value), set.end()));
+        EXPECT_EQ(std::distance(tree.upper_bound(value), tree.end()),
+                  std::distance(set.upper_bound(value), set.end()));
+        auto [first, last] = tree.equal_range(value);
+        EXPECT_EQ(std::distance(first, last), static_cast<std::ptrdiff_t>(set.count(value)));
+    }
+    EXPECT_EQ(*std::prev(tree.lower_bound(3000)), 598);
+}
+
+TEST(BPlusTreeSuite, EqualKeysAcrossLeaves) {
+    b_tree::BPlusTree<int, 2> tree;
+    for (int i = 0; i < 100; ++i) {
+        tree.insert(5);
+        tree.insert(i % 2 == 0 ? 1 : 9);
+    }
+    auto [first, last] = tree.equal_range(5);
+    EXPECT_EQ(std::distance(first, last), 100);
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_TRUE(tree.remove(5));
+    }
+    EXPECT_FALSE(tree.remove(5));
+    EXPECT_FALSE(tree.contains(5));
+    EXPECT_EQ(tree.size(), 100);
+    EXPECT_EQ(*tree.begin(), 1);
+    EXPECT_EQ(*tree.rbegin(), 9);
+}
+
+TEST(BPlusTreeSuite, RandomOperations) {
+    std::mt19937 random(42);
+    b_tree::BPlusTree<int, 3> tree;
+    std::multiset<int> set;
+    for (int i = 0; i < 20000; ++i) {
+        int const value = static_cast<int>(random() % 500);
+        if (random() % 3 != 0) {
+            tree.insert(value);
+            set.insert(value);
+        } else {
+            auto it = set.find(value);
+            EXPECT_EQ(tree.remove(value), it != set.end());
+            if (it != set.end()) set.erase(it);
+        }
+    }
+    expect_same_keys(tree, set);
+    for (int value = 0; value < 500; ++value) {
+        while (tree.remove(value)) {}
+    }
+    EXPECT_TRUE(tree.empty());
+    EXPECT_EQ(tree.begin(), tree.end());
+}
+
+TEST(BPlusTreeSuite, CopyAndMove) {
+    b_tree::BPlusTree<std::string, 2> tree;
+    for (int i = 0; i < 200; ++i) {
+        tree.insert(std::to_string(i));
+    }
+    auto copy = tree;
+    for (int i = 0; i < 200; i += 2) {
+        tree.remove(std::to_string(i));
+    }
+    EXPECT_EQ(copy.size(), 200);
+    EXPECT_TRUE(copy.contains("0"));
+    EXPECT_FALSE(tree.contains("0"));
+    EXPECT_EQ(std::distance(copy.rbegin(), copy.rend()), 200);
+
+    auto moved = std::move(copy);
+    EXPECT_TRUE(copy.empty());
+    EXPECT_EQ(moved.size(), 200);
+    copy = moved;
+    EXPECT_TRUE(std::equal(copy.begin(), copy.end(), moved.begin(), moved.end()));
+}
+
+// A copy that throws part of the way through frees all it copied.
+TEST(BPlusTreeSuite, ThrowingCopy) {
+    b_tree::BPlusTree<Fragile, 2> tree;
+    for (int i = 0; i < 500; ++i) {
+        tree.insert(Fragile(i));
+    }
+    long const alive = Fragile::alive;
+    for (long throw_at = 1;; ++throw_at) {
+        Fragile::throw_at = throw_at;
+        try {
+            auto const copy = tree;
+            Fragile::throw_at = -1;
+            EXPECT_EQ(copy.size(), 500);
+            EXPECT_TRUE(std::equal(copy.begin(), copy.end(), tree.begin(), tree.end(),
+                                   [](Fragile const &a, Fragile const &b) { return a.value == b.value; }));
+            break;
+        } catch (std::runtime_error const &) {
+            Fragile::throw_at = -1;
+            EXPECT_EQ(Fragile::alive, alive);
+        }
+    }
+    EXPECT_EQ(Fragile::alive, alive);
+}
@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "gtest/gtest.h"
+#include "b_tree_map.h"
+
+namespace {
+
+template<typename Map, typename StdMap>
+void expect_same_entries(Map const &map, StdMap const &expected) {
+    EXPECT_EQ(map.size(), expected.size());
+    auto equal = [](auto const &a, auto const &b) { return a.first == b.first && a.second == b.second; };
+    EXPECT_TRUE(std::equal(map.begin(), map.end(), expected.begin(), expected.end(), equal));
+    EXPECT_TRUE(std::equal(map.rbegin(), map.rend(), expected.rbegin(), expected.rend(), equal));
+}
+
+}  // namespace
+
+TEST(BTreeMapSuite, EmptyMap) {
+    b_tree::BTreeMap<int, std::string, 2> map;
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(map.size(), 0);
+    EXPECT_EQ(map.begin(), map.end());
+    EXPECT_EQ(map.find(1), map.end());
+    EXPECT_EQ(map.lower_bound(1), map.end());
+    EXPECT_FALSE(map.contains(1));
+    EXPECT_FALSE(map.remove(1));
+    EXPECT_THROW(static_cast<void>(map.at(1)), std::out_of_range);
+}
+
+TEST(BTreeMapSuite, SubscriptAndAt) {
+    b_tree::BTreeMap<std::string, int, 2> map;
+    for (int i = 0; i < 1000; ++i) {
+        map[std::to_string(i % 100)] += i;
+    }
+    EXPECT_EQ(map.size(), 100);
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(map.at(std::to_string(i)), i * 10 + 4500);
+    }
+    EXPECT_THROW(static_cast<void>(map.at("100")), std::out_of_range);
+}
+
+TEST(BTreeMapSuite, TryEmplaceAndInsertOrAssign) {
+    b_tree::BTreeMap<int, std::unique_ptr<int>, 3> map;
+    auto [it, added] = map.try_emplace(1, std::make_unique<int>(1));
+    EXPECT_TRUE(added);
+    EXPECT_EQ((*it).first, 1);
+    EXPECT_EQ(*it->second, 1);
+
+    // A key that is there already leaves the arguments alone.
+    auto value = std::make_unique<int>(2);
+    auto [same, added_again] = map.try_emplace(1, std::move(value));
+    EXPECT_FALSE(added_again);
+    EXPECT_EQ(same, it);
+    EXPECT_NE(value, nullptr);
+
+    EXPECT_FALSE(map.insert_or_assign(1, std::move(value)).second);
+    EXPECT_EQ(*map.at(1), 2);
+    EXPECT_TRUE(map.insert_or_assign(2, std::make_unique<int>(3)).second);
+    EXPECT_EQ(*map.at(2), 3);
+    EXPECT_EQ(map.size(), 2);
+}
+
+TEST(BTreeMapSuite, MutableIteration) {
+    b_tree::BTreeMap<int, int, 2> map;
+    for (int i = 0; i < 500; ++i) {
+        map[i * 7 % 500] = 0;
+    }
+    for (auto [key, value]: map) {
+        value = key * 2;
+    }
+    for (auto it = map.begin(); it != map.end(); ++it) {
+        it->second += 1;
+    }
+    int expected = 0;
+    for (auto const &[key, value]: std::as_const(map)) {
+        EXPECT_EQ(key, expected);
+        EXPECT_EQ(value, expected * 2 + 1);
+        ++expected;
+    }
+    EXPECT_EQ(expected, 500);
+
+    b_tree::BTreeMap<int, int, 2>::const_iterator first = map.begin();
+    EXPECT_EQ(first, std::as_const(map).begin());
+    EXPECT_EQ((*map.lower_bound(101)).first, 101);
+    EXPECT_EQ((*map.upper_bound(101)).first, 102);
+    EXPECT_EQ(map.upper_bound(499), map.end());
+}
+
+TEST(BTreeMapSuite, RandomOperations) {
+    for (size_t seed = 0; seed < 4; ++seed) {
+        std::mt19937 random(seed);
+        b_tree::BTreeMap<int, int, 2> map;
+        std::map<int, int> expected;
+        for (int op = 0; op < 20000; ++op) {
+            int const key = static_cast<int>(random() % 2000);
+            switch (random() % 3) {
+                case 0:
+                    EXPECT_EQ(map.insert_or_assign(key, op).second, expected.insert_or_assign(key, op).second);
+                    break;
+                case 1:
+                    EXPECT_EQ(map.try_emplace(key, op).second, expected.try_emplace(key, op).second);
+                    break;
+                default:
+                    EXPECT_EQ(map.remove(key), expected.erase(key) == 1);
+            }
+        }
+        expect_same_entries(map, expected);
+        for (int key = 0; key < 2000; ++key) {
+            EXPECT_EQ(map.contains(key), expected.contains(key));
+        }
+        for (auto const &[key, value]: expected) {
+            EXPECT_TRUE(map.remove(key));
+        }
+        EXPECT_TRUE(map.empty());
+        EXPECT_EQ(map.begin(), map.end());
+    }
+}
+
+TEST(BTreeMapSuite, CopyAndMove) {
+    b_tree::BTreeMap<int, std::string, 2> map;
+    std::map<int, std::string> expected;
+    for (int i = 0; i < 1000; ++i) {
+        map[i] = std::to_string(i);
+        expected[i] = std::to_string(i);
+    }
+    auto copy = map;
+    copy[0] = "changed";
+    EXPECT_EQ(map[0], "0");
+    expect_same_entries(map, expected);
+
+    auto moved = std::move(map);
+    expect_same_entries(moved, expected);
+    EXPECT_TRUE(map.empty());
+
+    map = copy;
+    EXPECT_EQ(map.size(), 1000);
+    EXPECT_EQ(map[0], "changed");
+    map.clear();
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(copy.size(), 1000);
+}
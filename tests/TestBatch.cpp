@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+#include "gtest/gtest.h"
+#include "b_tree.h"
+
+namespace {
+
+template<typename Tree>
+void expect_contents(Tree const &tree, std::multiset<int> const &expected) {
+    EXPECT_TRUE(std::equal(tree.begin(), tree.end(), expected.begin(), expected.end()));
+}
+
+}  // namespace
+
+TEST(BatchSuite, InsertIntoEmpty) {
+    b_tree::BTree<int, 3> tree;
+    tree.insert_batch(std::vector<int>{5, 1, 4, 1, 3});
+    expect_contents(tree, {1, 1, 3, 4, 5});
+    tree.insert_batch(std::vector<int>{});
+    expect_contents(tree, {1, 1, 3, 4, 5});
+}
+
+TEST(BatchSuite, InsertSortedRuns) {
+    b_tree::BTree<int, 2> tree;
+    std::multiset<int> expected;
+    for (int run = 0; run < 50; ++run) {
+        std::vector<int> batch;
+        for (int i = 0; i < 200; ++i) {
+            batch.push_back(run + i * 50);
+        }
+        tree.insert_batch(batch);
+        expected.insert(batch.begin(), batch.end());
+    }
+    expect_contents(tree, expected);
+    for (int value = 0; value < 10000; value += 7) {
+        EXPECT_TRUE(tree.contains(value));
+    }
+}
+
+TEST(BatchSuite, EraseCountsFoundValues) {
+    b_tree::BTree<int, 3> tree;
+    tree.insert_batch(std::vector<int>{1, 2, 2, 2, 3, 5, 8});
+    EXPECT_EQ(tree.erase_batch(std::vector<int>{2, 2, 4, 8, 8}), 3u);
+    expect_contents(tree, {1, 2, 3, 5});
+    EXPECT_EQ(tree.erase_batch(std::vector<int>{5, 1, 3, 2}), 4u);
+    EXPECT_TRUE(tree.empty());
+    EXPECT_EQ(tree.erase_batch(std::vector<int>{1}), 0u);
+}
+
+TEST(BatchSuite, EraseEverything) {
+    std::vector<int> values(5000);
+    for (int i = 0; i < 5000; ++i) {
+        values[i] = i;
+    }
+    b_tree::BTree<int, 4> tree;
+    tree.insert_batch(values);
+    EXPECT_EQ(tree.erase_batch(values), values.size());
+    EXPECT_TRUE(tree.empty());
+    tree.insert(1);
+    EXPECT_TRUE(tree.contains(1));
+}
+
+TEST(BatchSuite, MatchesMultiset) {
+    std::mt19937 gen(7);
+    for (int range: {50, 1000, 100000}) {
+        b_tree::BTree<int, 3> tree;
+        std::multiset<int> expected;
+        for (int round = 0; round < 200; ++round) {
+            std::vector<int> batch(std::uniform_int_distribution<int>(0, 300)(gen));
+            for (auto &value: batch) {
+                value = std::uniform_int_distribution<int>(0, range)(gen);
+            }
+            if (round % 3 == 2) {
+                size_t found = 0;
+                for (int value: batch) {
+                    auto it = expected.find(value);
+                    if (it != expected.end()) {
+                        expected.erase(it);
+                        ++found;
+                    }
+                }
+                EXPECT_EQ(tree.erase_batch(batch), found);
+            } else {
+                tree.insert_batch(batch);
+                expected.insert(batch.begin(), batch.end());
+            }
+            tree.insert(round);
+            expected.insert(round);
+            tree.remove(round / 2);
+            if (auto it = expected.find(round / 2); it != expected.end()) expected.erase(it);
+        }
+        expect_contents(tree, expected);
+    }
+}
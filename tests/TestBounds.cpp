@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <set>
+#include "gtest/gtest.h"
+#include "b_tree.h"
+
+namespace {
+
+template<typename Tree, typename Iterator, typename Set>
+void expect_same_position(Tree const &tree, Iterator it, Set const &set, typename Set::const_iterator expected) {
+    EXPECT_EQ(std::distance(it, tree.end()), std::distance(expected, set.end()));
+    if (expected != set.end()) {
+        ASSERT_NE(it, tree.end());
+        EXPECT_EQ(*it, *expected);
+    }
+}
+
+}  // namespace
+
+TEST(BoundsSuite, EmptyTree) {
+    b_tree::BTree<int, 2> tree;
+    EXPECT_EQ(tree.lower_bound(1), tree.end());
+    EXPECT_EQ(tree.upper_bound(1), tree.end());
+    auto [first, last] = tree.equal_range(1);
+    EXPECT_EQ(first, last);
+}
+
+TEST(BoundsSuite, MatchMultiset) {
+    for (int repeats: {1, 3}) {
+        b_tree::BTree<int, 2> tree;
+        std::multiset<int> set;
+        for (int i = 0; i < 300; ++i) {
+            for (int j = 0; j < repeats; ++j) {
+                tree.insert(i * 17 % 300 * 2);
+                set.insert(i * 17 % 300 * 2);
+            }
+        }
+        for (int value = -2; value <= 602; ++value) {
+            expect_same_position(tree, tree.lower_bound(value), set, set.lower_bound(value));
+            expect_same_position(tree, tree.upper_bound(value), set, set.upper_bound(value));
+            auto [first, last] = tree.equal_range(value);
+            EXPECT_EQ(std::distance(first, last), static_cast<std::ptrdiff_t>(set.count(value)));
+        }
+    }
+}
+
+TEST(BoundsSuite, RangeScan) {
+    b_tree::BTree<int, 4> tree;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(i * 3);
+    }
+    int expected = 300;
+    for (auto it = tree.lower_bound(299); it != tree.upper_bound(600); ++it) {
+        EXPECT_EQ(*it, expected);
+        expected += 3;
+    }
+    EXPECT_EQ(expected, 603);
+    EXPECT_EQ(*std::prev(tree.lower_bound(299)), 297);
+    EXPECT_EQ(tree.lower_bound(3000), tree.end());
+    EXPECT_EQ(*std::prev(tree.lower_bound(3000)), 2997);
+}
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <numeric>
+#include <ranges>
+#include <sstream>
+#include <vector>
+#include "gtest/gtest.h"
+#include "b_tree.h"
+
+namespace {
+
+std::vector<int> sorted_values(int n) {
+    std::vector<int> values(n);
+    for (int i = 0; i < n; ++i) {
+        values[i] = i / 3 * 2;  // a few repeats
+    }
+    return values;
+}
+
+template<typename Tree>
+void expect_contents(Tree const &tree, std::vector<int> const &values) {
+    EXPECT_TRUE(std::equal(tree.begin(), tree.end(), values.begin(), values.end()));
+}
+
+}  // namespace
+
+TEST(BulkLoadSuite, EmptyRange) {
+    std::vector<int> values;
+    b_tree::BTree<int, 3> tree(b_tree::from_sorted, values.begin(), values.end());
+    EXPECT_TRUE(tree.empty());
+    tree.insert(1);
+    EXPECT_TRUE(tree.contains(1));
+}
+
+TEST(BulkLoadSuite, AllSizes) {
+    for (int n = 1; n < 300; ++n) {
+        auto values = sorted_values(n);
+        b_tree::BTree<int, 2> tree(b_tree::from_sorted, values.begin(), values.end());
+        expect_contents(tree, values);
+        EXPECT_TRUE(tree.contains(values.back()));
+        EXPECT_FALSE(tree.contains(values.back() + 1));
+    }
+}
+
+TEST(BulkLoadSuite, FillFactors) {
+    auto values = sorted_values(10000);
+    for (double fill_factor: {1.0, 0.9, 0.75, 0.5, 0.1}) {
+        b_tree::BTree<int, 5> tree(b_tree::from_sorted, values.begin(), values.end(), fill_factor);
+        expect_contents(tree, values);
+    }
+}
+
+TEST(BulkLoadSuite, UpdatesAfterLoad) {
+    auto values = sorted_values(5000);
+    for (double fill_factor: {1.0, 0.5}) {
+        b_tree::BTree<int, 4> tree(b_tree::from_sorted, values.begin(), values.end(), fill_factor);
+        auto expected = values;
+        for (int i = 0; i < 2000; ++i) {
+            int value = i * 7 % 5000;
+            tree.insert(value);
+            expected.insert(std::upper_bound(expected.begin(), expected.end(), value), value);
+        }
+        expect_contents(tree, expected);
+        for (int i = 0; i < 3000; ++i) {
+            int value = i * 11 % 3400;
+            auto it = std::lower_bound(expected.begin(), expected.end(), value);
+            EXPECT_EQ(tree.contains(value), it != expected.end() && *it == value);
+            if (it != expected.end() && *it == value) expected.erase(it);
+            tree.remove(value);
+        }
+        expect_contents(tree, expected);
+    }
+}
+
+TEST(BulkLoadSuite, AssignFromRanges) {
+    auto values = sorted_values(1000);
+    b_tree::BTree<int, 3> tree;
+    tree.insert(-5);
+
+    tree.assign_sorted(values);
+    expect_contents(tree, values);
+    EXPECT_FALSE(tree.contains(-5));
+
+    // Forward but not sized.
+    auto even = values | std::views::filter([](int value) { return value % 4 == 0; });
+    tree.assign_sorted(even, 0.6);
+    std::vector<int> expected(even.begin(), even.end());
+    expect_contents(tree, expected);
+
+    // Single pass.
+    std::stringstream stream;
+    for (int value: values) stream << value << ' ';
+    tree.assign_sorted(std::ranges::subrange(std::istream_iterator<int>(stream), std::istream_iterator<int>()));
+    expect_contents(tree, values);
+}
+
+TEST(BulkLoadSuite, CustomComparator) {
+    std::vector<int> values(777);
+    std::iota(values.rbegin(), values.rend(), 0);
+    b_tree::BTree<int, 6, std::greater<>> tree(b_tree::from_sorted, values.begin(), values.end(), 0.8,
+                                               std::greater<>());
+    expect_contents(tree, values);
+    tree.insert(1000);
+    EXPECT_EQ(*tree.begin(), 1000);
+}
@@ -0,0 +1,138 @@
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "concurrent_b_tree.h"
+
+TEST(ConcurrentBTreeSuite, EmptyTree) {
+    b_tree::ConcurrentBTree<int, 2> tree;
+    EXPECT_EQ(tree.size(), 0);
+    EXPECT_FALSE(tree.contains(1));
+    EXPECT_FALSE(tree.find(1).has_value());
+    EXPECT_FALSE(tree.remove(1));
+}
+
+TEST(ConcurrentBTreeSuite, MatchesSetOnOneThread) {
+    for (unsigned seed = 0; seed < 4; ++seed) {
+        std::mt19937 random(seed);
+        b_tree::ConcurrentBTree<int, 2> tree;
+        std::set<int> set;
+        for (int op = 0; op < 20000; ++op) {
+            int const key = static_cast<int>(random() % 3000);
+            if (random() % 2 == 0) {
+                EXPECT_EQ(tree.insert(key), set.insert(key).second);
+            } else {
+                EXPECT_EQ(tree.remove(key), set.erase(key) == 1);
+            }
+        }
+        EXPECT_EQ(tree.size(), set.size());
+        for (int key = 0; key < 3000; ++key) {
+            EXPECT_EQ(tree.contains(key), set.contains(key));
+            EXPECT_EQ(tree.find(key), set.contains(key) ? std::optional(key) : std::nullopt);
+        }
+    }
+}
+
+// Writers insert and remove keys of their own while readers look for keys
+// that are in the tree all along, which they must always find however the
+// nodes around them get split.
+TEST(ConcurrentBTreeSuite, ReadersAndWritersAtOnce) {
+    constexpr int64_t writers = 4;
+    constexpr int64_t readers = 4;
+    constexpr int64_t keys_per_thread = 20000;
+    b_tree::ConcurrentBTree<int64_t, 3> tree;
+    for (int64_t key = 1; key <= keys_per_thread; ++key) {
+        tree.insert(-key);
+    }
+
+    std::atomic<int64_t> failures{0};
+    std::atomic<int64_t> writers_left{writers};
+    std::vector<std::thread> threads;
+    for (int64_t writer = 0; writer < writers; ++writer) {
+        threads.emplace_back([&, writer] {
+            for (int64_t i = 0; i < keys_per_thread; ++i) {
+                int64_t const key = i * writers + writer;
+                failures += !tree.insert(key);
+                if (i % 3 == 0) {
+                    failures += !tree.remove(key);
+                    failures += tree.contains(key);
+                }
+            }
+            --writers_left;
+        });
+    }
+    for (int64_t reader = 0; reader < readers; ++reader) {
+        threads.emplace_back([&, reader] {
+            std::mt19937_64 random(reader);
+            do {
+                for (int i = 0; i < 1000; ++i) {
+                    int64_t const key = -static_cast<int64_t>(random() % keys_per_thread) - 1;
+                    failures += tree.find(key) != key;
+                }
+            } while (writers_left != 0);
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    EXPECT_EQ(failures, 0);
+
+    size_t expected_size = keys_per_thread;
+    for (int64_t key = 0; key < writers * keys_per_thread; ++key) {
+        bool const kept = key / writers % 3 != 0;
+        expected_size += kept;
+        EXPECT_EQ(tree.contains(key), kept);
+    }
+    EXPECT_EQ(tree.size(), expected_size);
+}
+
+TEST(ConcurrentBTreeSuite, ConcurrentInsertsOfTheSameKeys) {
+    constexpr int threads_count = 4;
+    constexpr int keys = 10000;
+    b_tree::ConcurrentBTree<int, 2> tree;
+    std::atomic<int> inserted{0};
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < threads_count; ++thread) {
+        threads.emplace_back([&] {
+            for (int key = 0; key < keys; ++key) {
+                inserted += tree.insert(key);
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    EXPECT_EQ(inserted, keys);
+    EXPECT_EQ(tree.size(), keys);
+}
+
+// Keys whose size is not a multiple of 8 are kept as narrower words.
+TEST(ConcurrentBTreeSuite, KeysOfOddSizes) {
+    struct Triple {
+        int32_t a, b, c;
+
+        bool operator<(Triple const &other) const {
+            return a < other.a;
+        }
+    };
+    b_tree::ConcurrentBTree<Triple, 2> tree;
+    for (int32_t key = 0; key < 1000; ++key) {
+        EXPECT_TRUE(tree.insert({(key * 7) % 1000, key, -key}));
+    }
+    EXPECT_EQ(tree.size(), 1000);
+    for (int32_t key = 0; key < 1000; ++key) {
+        auto const found = tree.find(Triple{(key * 7) % 1000, 0, 0});
+        ASSERT_TRUE(found.has_value());
+        EXPECT_EQ(found->b, key);
+        EXPECT_EQ(found->c, -key);
+    }
+    for (int32_t key = 0; key < 1000; key += 2) {
+        EXPECT_TRUE(tree.remove(Triple{key, 0, 0}));
+    }
+    EXPECT_EQ(tree.size(), 500);
+    EXPECT_FALSE(tree.contains(Triple{0, 0, 0}));
+    EXPECT_TRUE(tree.contains(Triple{1, 0, 0}));
+}
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <random>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "gtest/gtest.h"
+#include "b_tree.h"
+#include "test_helpers.h"
+
+namespace {
+
+struct counted_copy_on_write_policy : b_tree::order_statistics_policy {
+    static constexpr bool copy_on_write = true;
+};
+
+// Counts live instances, so that copying keys shows.
+struct Counted {
+    Counted(int value) : value(value) { ++alive; }
+
+    Counted(Counted const &other) : value(other.value) { ++alive; }
+
+    Counted &operator=(Counted const &) = default;
+
+    ~Counted() { --alive; }
+
+    friend bool operator<(Counted const &a, Counted const &b) { return a.value < b.value; }
+
+    int value;
+
+    static inline long alive = 0;
+};
+
+}  // namespace
+
+TEST(CopyOnWriteSuite, SnapshotsStayAsTheyWere) {
+    for (unsigned seed = 0; seed < 4; ++seed) {
+        std::mt19937 random(seed);
+        b_tree::BTree<int, 2, std::less<>, std::allocator<int>, b_tree::copy_on_write_policy> tree;
+        std::multiset<int> expected;
+        std::vector<std::pair<decltype(tree), std::multiset<int>>> snapshots;
+        for (int op = 0; op < 20000; ++op) {
+            int const key = static_cast<int>(random() % 1000);
+            if (random() % 3 != 0) {
+                tree.insert(key);
+                expected.insert(key);
+            } else {
+                auto const it = expected.find(key);
+                EXPECT_EQ(tree.remove(key), it != expected.end());
+                if (it != expected.end()) expected.erase(it);
+            }
+            if (op % 1000 == 0) snapshots.emplace_back(tree, expected);
+        }
+        expect_same_keys(tree, expected);
+        for (auto const &[snapshot, keys]: snapshots) {
+            expect_same_keys(snapshot, keys);
+        }
+    }
+}
+
+TEST(CopyOnWriteSuite, SnapshotsOfSnapshots) {
+    b_tree::BTree<int, 3, std::less<>, std::allocator<int>, b_tree::copy_on_write_policy> tree;
+    std::multiset<int> expected;
+    for (int i = 0; i < 3000; ++i) {
+        tree.insert(i);
+        expected.insert(i);
+    }
+    auto copy = tree;
+    auto copy_of_copy = copy;
+    std::multiset<int> copied = expected;
+    for (int i = 0; i < 3000; i += 2) {
+        copy.remove(i);
+        copied.erase(i);
+        tree.insert(i);
+        expected.insert(i);
+    }
+    expect_same_keys(tree, expected);
+    expect_same_keys(copy, copied);
+    tree = copy;
+    tree.insert(-1);
+    expect_same_keys(copy, copied);
+    copy = std::move(copy_of_copy);
+    copy.clear();
+    expect_same_keys(tree, [&] {
+        copied.insert(-1);
+        return copied;
+    }());
+}
+
+TEST(CopyOnWriteSuite, BatchesAndSubtreeCounts) {
+    std::mt19937 random(42);
+    b_tree::BTree<int, 2, std::less<>, std::allocator<int>, counted_copy_on_write_policy> tree;
+    std::multiset<int> expected;
+    std::vector<std::pair<decltype(tree), std::multiset<int>>> snapshots;
+    for (int round = 0; round < 50; ++round) {
+        std::vector<int> batch(200);
+        for (int &value: batch) {
+            value = static_cast<int>(random() % 2000);
+        }
+        if (round % 3 != 2) {
+            tree.insert_batch(batch);
+            expected.insert(batch.begin(), batch.end());
+        } else {
+            size_t erased = 0;
+            for (int value: batch) {
+                auto const it = expected.find(value);
+                if (it != expected.end()) {
+                    expected.erase(it);
+                    ++erased;
+                }
+            }
+            EXPECT_EQ(tree.erase_batch(batch), erased);
+        }
+        snapshots.emplace_back(tree, expected);
+    }
+    snapshots.emplace_back(tree, expected);
+    tree.assign_sorted(std::vector{1, 2, 3});
+    EXPECT_EQ(tree.size(), 3);
+    for (auto const &[snapshot, keys]: snapshots) {
+        expect_same_keys(snapshot, keys);
+        for (int value = 0; value < 2000; value += 97) {
+            auto const rank = static_cast<size_t>(std::distance(keys.begin(), keys.lower_bound(value)));
+            EXPECT_EQ(snapshot.rank(value), rank);
+            if (rank < keys.size()) EXPECT_EQ(*snapshot.nth(rank), *keys.lower_bound(value));
+        }
+    }
+}
+
+TEST(CopyOnWriteSuite, CopiesShareKeys) {
+    {
+        b_tree::BTree<Counted, 4, std::less<>, std::allocator<Counted>, b_tree::copy_on_write_policy> tree;
+        for (int i = 0; i < 10000; ++i) {
+            tree.insert(i);
+        }
+        EXPECT_EQ(Counted::alive, 10000);
+        auto snapshot = tree;
+        EXPECT_EQ(Counted::alive, 10000);
+        // One insert copies the nodes on its way down, and the ones split.
+        tree.insert(10000);
+        EXPECT_LT(Counted::alive, 10000 + 100);
+        EXPECT_EQ(snapshot.size(), 10000);
+        EXPECT_EQ(tree.size(), 10001);
+        tree.remove(5000);
+        EXPECT_LT(Counted::alive, 10000 + 200);
+        EXPECT_TRUE(snapshot.contains(5000));
+        EXPECT_FALSE(tree.contains(5000));
+    }
+    EXPECT_EQ(Counted::alive, 0);
+}
+
+// Readers get snapshots of a tree that keeps changing, and drop them on
+// their own threads.
+TEST(CopyOnWriteSuite, SnapshotsOnOtherThreads) {
+    using Tree = b_tree::BTree<int, 3, std::less<>, std::allocator<int>, b_tree::copy_on_write_policy>;
+    Tree tree;
+    std::vector<std::thread> readers;
+    std::vector<bool> consistent(8);
+    for (int i = 0; i < 8; ++i) {
+        for (int key = 0; key < 2000; ++key) {
+            tree.insert(i * 2000 + key);
+            if (key % 3 == 0) tree.remove(i * 2000 + key / 3);
+        }
+        readers.emplace_back([snapshot = Tree(tree), &consistent = consistent, i]() mutable {
+            bool ok = std::is_sorted(snapshot.begin(), snapshot.end())
+                      && static_cast<size_t>(std::distance(snapshot.begin(), snapshot.end())) == snapshot.size();
+            snapshot.insert(-1);
+            snapshot.clear();
+            consistent[i] = ok;
+        });
+    }
+    for (auto &reader: readers) {
+        reader.join();
+    }
+    EXPECT_TRUE(std::all_of(consistent.begin(), consistent.end(), [](bool ok) { return ok; }));
+    EXPECT_TRUE(std::is_sorted(tree.begin(), tree.end()));
+}
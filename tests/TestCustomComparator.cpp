@@ -1,3 +1,7 @@
+#include <cctype>
+#include <compare>
+#include <string>
+#include <vector>
 #include "gtest/gtest.h"
 #include "b_tree.h"
 
@@ -30,3 +34,66 @@ TEST(ComparatorSuite, ComparatorWorks) {
     a.remove({.n = 0});
     ASSERT_FALSE(a.contains({.n = 0}));
 }
+
+struct CaseInsensitive {
+    std::weak_ordering operator()(std::string const &a, std::string const &b) const {
+        for (size_t i = 0; i < a.size() && i < b.size(); ++i) {
+            int const x = std::tolower(static_cast<unsigned char>(a[i]));
+            int const y = std::tolower(static_cast<unsigned char>(b[i]));
+            if (x != y) return x <=> y;
+        }
+        return a.size() <=> b.size();
+    }
+};
+
+TEST(ComparatorSuite, ThreeWayComparator) {
+    b_tree::BTree<std::string, 2, CaseInsensitive> tree;
+    for (int i = 0; i < 200; ++i) {
+        tree.insert("Key" + std::to_string(i));
+    }
+    tree.insert_batch(std::vector<std::string>{"a", "B", "c"});
+    EXPECT_TRUE(tree.contains("KEY17"));
+    EXPECT_TRUE(tree.contains("b"));
+    EXPECT_FALSE(tree.contains("key200"));
+    EXPECT_EQ(*tree.find("key5"), "Key5");
+    EXPECT_EQ(tree.find("key"), tree.end());
+    EXPECT_EQ(std::distance(tree.lower_bound("key1"), tree.upper_bound("key2")), 112);
+    EXPECT_TRUE(tree.remove("KEY0"));
+    EXPECT_FALSE(tree.contains("Key0"));
+    EXPECT_EQ(tree.erase_batch(std::vector<std::string>{"A", "b", "d"}), 2);
+    EXPECT_EQ(tree.size(), 200);
+}
+
+// Counts the comparisons it takes part in.
+struct Counted {
+    int n;
+
+    inline static int less_calls = 0;
+    inline static int three_way_calls = 0;
+
+    friend bool operator<(Counted const &a, Counted const &b) {
+        ++less_calls;
+        return a.n < b.n;
+    }
+
+    friend std::strong_ordering operator<=>(Counted const &a, Counted const &b) {
+        ++three_way_calls;
+        return a.n <=> b.n;
+    }
+
+    friend bool operator==(Counted const &a, Counted const &b) = default;
+};
+
+TEST(ComparatorSuite, ContainsComparesOncePerProbe) {
+    b_tree::BTree<Counted, 4> tree;
+    for (int i = 0; i < 7; ++i) {
+        tree.insert({i});
+    }
+    for (int i = 0; i < 7; ++i) {
+        Counted::less_calls = Counted::three_way_calls = 0;
+        EXPECT_TRUE(tree.contains({i}));
+        // A binary search over the 7 keys of the root leaf.
+        EXPECT_EQ(Counted::less_calls, 0);
+        EXPECT_LE(Counted::three_way_calls, 3);
+    }
+}
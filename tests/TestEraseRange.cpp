@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "b_tree.h"
+#include "test_helpers.h"
+
+namespace {
+
+// Equal keys that can still be told apart.
+struct Tagged {
+    int key;
+    int tag;
+
+    friend bool operator<(Tagged const &a, Tagged const &b) { return a.key < b.key; }
+};
+
+template<typename Policy>
+void erase_random_ranges() {
+    for (unsigned seed = 0; seed < 4; ++seed) {
+        std::mt19937 random(seed);
+        b_tree::BTree<int, 2, std::less<>, std::allocator<int>, Policy> tree;
+        std::multiset<int> expected;
+        for (int round = 0; round < 200; ++round) {
+            for (int i = 0; i < 300; ++i) {
+                int const key = static_cast<int>(random() % 2000);
+                tree.insert(key);
+                expected.insert(key);
+            }
+            if (round % 2 == 0) {
+                int const low = static_cast<int>(random() % 2000);
+                int const high = low + static_cast<int>(random() % 1000);
+                auto const first = expected.lower_bound(low);
+                auto const last = expected.lower_bound(high);
+                EXPECT_EQ(tree.erase_range(low, high), static_cast<size_t>(std::distance(first, last)));
+                expected.erase(first, last);
+            } else {
+                auto const a = random() % (expected.size() + 1);
+                auto const b = random() % (expected.size() + 1);
+                auto const from = static_cast<std::ptrdiff_t>(std::min(a, b));
+                auto const to = static_cast<std::ptrdiff_t>(std::max(a, b));
+                auto const next = tree.erase(std::next(tree.begin(), from), std::next(tree.begin(), to));
+                expected.erase(std::next(expected.begin(), from), std::next(expected.begin(), to));
+                EXPECT_EQ(std::distance(tree.begin(), next), from);
+            }
+            expect_same_keys(tree, expected);
+        }
+    }
+}
+
+}  // namespace
+
+TEST(EraseRangeSuite, EraseByIterator) {
+    b_tree::BTree<int, 2> tree;
+    std::multiset<int> expected;
+    for (int i = 0; i < 3000; ++i) {
+        tree.insert(i % 1000);
+        expected.insert(i % 1000);
+    }
+    // Every third key, in one pass.
+    int position = 0;
+    for (auto it = tree.begin(); it != tree.end(); ++position) {
+        if (position % 3 == 0) it = tree.erase(it);
+        else ++it;
+    }
+    position = 0;
+    for (auto it = expected.begin(); it != expected.end(); ++position) {
+        if (position % 3 == 0) it = expected.erase(it);
+        else ++it;
+    }
+    expect_same_keys(tree, expected);
+    while (!tree.empty()) {
+        EXPECT_EQ(tree.erase(std::prev(tree.end())), tree.end());
+    }
+}
+
+TEST(EraseRangeSuite, EraseRanges) {
+    b_tree::BTree<int, 3> tree;
+    for (int i = 0; i < 10000; ++i) {
+        tree.insert(i);
+    }
+    EXPECT_EQ(tree.erase_range(100, 9900), 9800);
+    EXPECT_EQ(tree.size(), 200);
+    EXPECT_EQ(*tree.lower_bound(100), 9900);
+    EXPECT_EQ(tree.erase_range(50, 50), 0);
+    EXPECT_EQ(tree.erase_range(9950, 20000), 50);
+    EXPECT_EQ(tree.erase_range(-5, 0), 0);
+    EXPECT_EQ(tree.erase(tree.begin(), tree.end()), tree.end());
+    EXPECT_TRUE(tree.empty());
+    tree.insert(1);
+    EXPECT_EQ(*tree.begin(), 1);
+}
+
+TEST(EraseRangeSuite, RandomRanges) {
+    erase_random_ranges<b_tree::default_policy>();
+}
+
+TEST(EraseRangeSuite, RandomRangesCounted) {
+    erase_random_ranges<b_tree::order_statistics_policy>();
+}
+
+// Only the equal keys in range go, whichever they are.
+TEST(EraseRangeSuite, EqualKeysAtTheEdges) {
+    b_tree::BTree<Tagged, 2> tree;
+    for (int tag = 0; tag < 500; ++tag) {
+        tree.insert(Tagged{tag % 5, tag});
+    }
+    std::vector<Tagged> keys(tree.begin(), tree.end());
+    auto const next = tree.erase(std::next(tree.begin(), 150), std::next(tree.begin(), 320));
+    keys.erase(keys.begin() + 150, keys.begin() + 320);
+    EXPECT_EQ(next->tag, keys[150].tag);
+    EXPECT_EQ(std::next(next)->tag, keys[151].tag);
+    EXPECT_TRUE(std::equal(tree.begin(), tree.end(), keys.begin(), keys.end(), [](Tagged const &a, Tagged const &b) {
+        return a.tag == b.tag;
+    }));
+}
+
+// Ranges that end at every key, the first keys of leaves among them, so
+// that some nodes on the way keep all their keys. Keys that are not
+// trivially relocatable must then stay put rather than be moved onto
+// themselves.
+TEST(EraseRangeSuite, StringKeys) {
+    using Tree = b_tree::BTree<std::string, 2>;
+    std::multiset<std::string> all;
+    Tree full;
+    for (int i = 0; i < 194; ++i) {
+        all.insert(std::to_string(i));
+        full.insert(std::to_string(i));
+    }
+    for (auto last = all.begin(); last != all.end(); ++last) {
+        for (size_t length: {0, 1, 2, 19}) {
+            auto const first = std::prev(last, static_cast<std::ptrdiff_t>(
+                    std::min<size_t>(length, std::distance(all.begin(), last))));
+            Tree tree = full;
+            auto expected = all;
+            EXPECT_EQ(tree.erase_range(*first, *last), static_cast<size_t>(std::distance(first, last)));
+            expected.erase(expected.lower_bound(*first), expected.lower_bound(*last));
+            EXPECT_TRUE(std::equal(tree.begin(), tree.end(), expected.begin(), expected.end()));
+
+            Tree other = full;
+            auto const from = std::distance(all.begin(), first);
+            auto const to = std::distance(all.begin(), last);
+            auto const next = other.erase(std::next(other.begin(), from), std::next(other.begin(), to));
+            EXPECT_EQ(*next, *last);
+            EXPECT_TRUE(std::equal(other.begin(), other.end(), expected.begin(), expected.end()));
+        }
+    }
+}
+
+TEST(EraseRangeSuite, SnapshotsKeepTheirKeys) {
+    b_tree::BTree<int, 2, std::less<>, std::allocator<int>, b_tree::copy_on_write_policy> tree;
+    std::multiset<int> expected;
+    for (int i = 0; i < 5000; ++i) {
+        tree.insert(i);
+        expected.insert(i);
+    }
+    auto const snapshot = tree;
+    EXPECT_EQ(tree.erase_range(1000, 4000), 3000);
+    EXPECT_EQ(*tree.erase(tree.find(500)), 501);
+    expect_same_keys(snapshot, expected);
+    expected.erase(expected.lower_bound(1000), expected.lower_bound(4000));
+    expected.erase(500);
+    expect_same_keys(tree, expected);
+}
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <ranges>
+#include <set>
+#include <vector>
+#include "gtest/gtest.h"
+#include "b_tree.h"
+
+namespace {
+
+// Equal keys that can still be told apart.
+struct Tagged {
+    int key;
+    int tag;
+
+    friend bool operator<(Tagged const &a, Tagged const &b) { return a.key < b.key; }
+};
+
+size_t allocated_nodes = 0;
+
+template<typename T>
+struct CountingAllocator : std::allocator<T> {
+    template<typename U>
+    struct rebind {
+        using other = CountingAllocator<U>;
+    };
+
+    CountingAllocator() = default;
+
+    template<typename U>
+    CountingAllocator(CountingAllocator<U> const &) noexcept {}
+
+    T *allocate(size_t n) {
+        ++allocated_nodes;
+        return std::allocator<T>::allocate(n);
+    }
+};
+
+}  // namespace
+
+// Splitting in the middle would leave every node but the last half empty.
+TEST(HintedInsertSuite, AppendsFillTheNodes) {
+    allocated_nodes = 0;
+    b_tree::BTree<int, 4, std::less<>, CountingAllocator<int>> tree;
+    for (int i = 0; i < 70000; ++i) {
+        tree.insert(i);
+    }
+    EXPECT_LT(allocated_nodes, 70000 / 7 * 11 / 10);
+    EXPECT_TRUE(std::ranges::equal(tree, std::views::iota(0, 70000)));
+    for (int i = 0; i < 70000; i += 3) {
+        EXPECT_TRUE(tree.remove(i));
+    }
+    EXPECT_EQ(tree.size(), 46666);
+}
+
+TEST(HintedInsertSuite, EndHintAppends) {
+    b_tree::BTree<int, 2, std::less<>, std::allocator<int>, b_tree::order_statistics_policy> tree;
+    for (int i = 0; i < 5000; ++i) {
+        auto const it = tree.insert(tree.end(), i / 2);
+        EXPECT_EQ(*it, i / 2);
+        EXPECT_EQ(std::next(it), tree.end());
+    }
+    for (size_t i = 0; i < 5000; i += 7) {
+        EXPECT_EQ(*tree.nth(i), static_cast<int>(i / 2));
+    }
+}
+
+TEST(HintedInsertSuite, KeysGoRightBeforeTheHint) {
+    std::mt19937 random(1);
+    b_tree::BTree<Tagged, 2> tree;
+    std::vector<Tagged> expected;
+    for (int tag = 0; tag < 3000; ++tag) {
+        auto const position = static_cast<std::ptrdiff_t>(random() % (expected.size() + 1));
+        int const low = position == 0 ? 0 : expected[position - 1].key;
+        int const high = position == static_cast<std::ptrdiff_t>(expected.size()) ? low + 2 : expected[position].key;
+        Tagged const key{low + static_cast<int>(random() % (high - low + 1)), tag};
+        auto const it = tree.insert(std::next(tree.begin(), position), key);
+        expected.insert(expected.begin() + position, key);
+        EXPECT_EQ(it->tag, tag);
+        EXPECT_EQ(std::distance(tree.begin(), it), position);
+    }
+    EXPECT_TRUE(std::equal(tree.begin(), tree.end(), expected.begin(), expected.end(),
+                           [](Tagged const &a, Tagged const &b) { return a.tag == b.tag; }));
+}
+
+TEST(HintedInsertSuite, WrongHintsAreIgnored) {
+    std::mt19937 random(2);
+    b_tree::BTree<int, 3> tree;
+    std::multiset<int> expected;
+    for (int i = 0; i < 5000; ++i) {
+        int const key = static_cast<int>(random() % 1000);
+        auto const hint = std::next(tree.begin(), static_cast<std::ptrdiff_t>(random() % (tree.size() + 1)));
+        EXPECT_EQ(*tree.insert(hint, key), key);
+        expected.insert(key);
+    }
+    EXPECT_TRUE(std::equal(tree.begin(), tree.end(), expected.begin(), expected.end()));
+}
+
+TEST(HintedInsertSuite, SortedRunsWithTheNextHint) {
+    b_tree::BTree<int, 3, std::less<>, std::allocator<int>, b_tree::copy_on_write_policy> tree;
+    std::multiset<int> expected;
+    for (int run = 0; run < 20; ++run) {
+        auto const snapshot = tree;
+        auto hint = tree.begin();
+        for (int i = 0; i < 500; ++i) {
+            hint = std::next(tree.insert(hint, run + i * 20));
+            expected.insert(run + i * 20);
+        }
+        EXPECT_EQ(snapshot.size(), expected.size() - 500);
+    }
+    EXPECT_TRUE(std::equal(tree.begin(), tree.end(), expected.begin(), expected.end()));
+}
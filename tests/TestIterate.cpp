@@ -1,8 +1,11 @@
 #include <algorithm>
+#include <iterator>
+#include <ranges>
 #include <vector>
 #include <unordered_set>
 
 #include "gtest/gtest.h"
+#include "b_plus_tree.h"
 #include "b_tree.h"
 
 class IterateSuite : public testing::Test {
@@ -95,3 +98,56 @@ TEST_F(IterateSuite, BeginEqEndEmpty) {
     ASSERT_TRUE(tree.empty());
     EXPECT_TRUE(tree.begin() == tree.end());
 }
+
+TEST_F(IterateSuite, EndIsReachedAndLeft) {
+    b_tree::BTree<int, 2> tree;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(i);
+    }
+    auto it = tree.lower_bound(990);
+    for (int i = 990; i < 1000; ++i) {
+        EXPECT_EQ(*it++, i);
+    }
+    EXPECT_EQ(it, tree.end());
+    EXPECT_EQ(*--it, 999);
+    auto end = tree.end();
+    auto copy = end;
+    EXPECT_EQ(*std::prev(copy), 999);
+    EXPECT_EQ(copy, end);
+    int expected = 999;
+    for (auto rit = tree.rbegin(); rit != tree.rend(); ++rit) {
+        EXPECT_EQ(*rit, expected--);
+    }
+    EXPECT_EQ(expected, -1);
+}
+
+static_assert(std::ranges::bidirectional_range<b_tree::BTree<int, 2>>);
+static_assert(std::ranges::bidirectional_range<b_tree::BPlusTree<int, 2>>);
+static_assert(std::sentinel_for<std::default_sentinel_t, b_tree::BTree<int, 2>::iterator>);
+static_assert(std::sentinel_for<std::default_sentinel_t, b_tree::BPlusTree<int, 2>::iterator>);
+
+TEST_F(IterateSuite, DefaultSentinelAndRanges) {
+    b_tree::BTree<int, 2> tree;
+    b_tree::BPlusTree<int, 2> plus_tree;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(i * 7 % 1000);
+        plus_tree.insert(i * 7 % 1000);
+    }
+    int expected = 0;
+    for (auto it = tree.begin(); it != std::default_sentinel; ++it) {
+        EXPECT_EQ(*it, expected++);
+    }
+    EXPECT_EQ(expected, 1000);
+    EXPECT_TRUE(tree.end() == std::default_sentinel);
+    EXPECT_TRUE((b_tree::BTree<int, 2>::iterator() == std::default_sentinel));
+    EXPECT_TRUE(plus_tree.end() == std::default_sentinel);
+    EXPECT_FALSE(plus_tree.begin() == std::default_sentinel);
+
+    auto odd = [](int value) { return value % 2 != 0; };
+    auto odd_keys = tree | std::views::filter(odd) | std::views::reverse;
+    EXPECT_EQ(*std::ranges::begin(odd_keys), 999);
+    EXPECT_EQ(std::ranges::distance(odd_keys), 500);
+    EXPECT_EQ(*std::ranges::find(plus_tree, 42), 42);
+    EXPECT_TRUE(std::ranges::equal(tree, plus_tree));
+    EXPECT_EQ(std::ranges::count_if(plus_tree | std::views::take(10), odd), 5);
+}
@@ -0,0 +1,198 @@
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "gtest/gtest.h"
+#include "b_tree.h"
+
+// Not default-constructible, counts live instances.
+class Tracked {
+public:
+    explicit Tracked(int value) : value_(value) { ++alive; }
+
+    Tracked(Tracked const &other) : value_(other.value_) { ++alive; }
+
+    Tracked &operator=(Tracked const &) = default;
+
+    ~Tracked() { --alive; }
+
+    friend bool operator<(Tracked const &a, Tracked const &b) { return a.value_ < b.value_; }
+
+    static inline long alive = 0;
+
+private:
+    int value_;
+};
+
+TEST(KeyLifetimeSuite, OnlyStoredKeysAreAlive) {
+    {
+        b_tree::BTree<Tracked, 3> tree;
+        EXPECT_EQ(Tracked::alive, 0);
+        for (int i = 0; i < 500; ++i) {
+            tree.insert(Tracked(i * 7 % 500));
+            EXPECT_EQ(Tracked::alive, i + 1);
+        }
+        for (int i = 0; i < 250; ++i) {
+            tree.remove(Tracked(i * 3 % 500));
+        }
+        EXPECT_EQ(Tracked::alive, 250);
+        EXPECT_TRUE(tree.contains(Tracked(499)));
+        EXPECT_FALSE(tree.contains(Tracked(3)));
+    }
+    EXPECT_EQ(Tracked::alive, 0);
+}
+
+TEST(KeyLifetimeSuite, CopiesAndClearsReleaseKeys) {
+    {
+        b_tree::BTree<Tracked, 2> tree;
+        for (int i = 0; i < 100; ++i) {
+            tree.insert(Tracked(i));
+        }
+        auto copy = tree;
+        EXPECT_EQ(Tracked::alive, 200);
+        tree.clear();
+        EXPECT_EQ(Tracked::alive, 100);
+        for (int i = 0; i < 100; ++i) {
+            copy.remove(Tracked(i));
+        }
+        EXPECT_TRUE(copy.empty());
+        EXPECT_EQ(Tracked::alive, 0);
+        copy.insert(Tracked(1));
+    }
+    EXPECT_EQ(Tracked::alive, 0);
+}
+
+// Counts how often it gets copied, moves are free.
+class CopyCounted {
+public:
+    explicit CopyCounted(int value) : value_(value) {}
+
+    CopyCounted(CopyCounted const &other) : value_(other.value_) { ++copies; }
+
+    CopyCounted(CopyCounted &&other) noexcept = default;
+
+    CopyCounted &operator=(CopyCounted const &other) {
+        value_ = other.value_;
+        ++copies;
+        return *this;
+    }
+
+    CopyCounted &operator=(CopyCounted &&other) noexcept = default;
+
+    friend bool operator<(CopyCounted const &a, CopyCounted const &b) noexcept { return a.value_ < b.value_; }
+
+    static inline long copies = 0;
+
+private:
+    int value_;
+};
+
+TEST(KeyLifetimeSuite, RvaluesAreNotCopied) {
+    b_tree::BTree<CopyCounted, 3> tree;
+    CopyCounted::copies = 0;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(CopyCounted(i * 7 % 1000));
+        tree.emplace(1000 + i);
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        EXPECT_TRUE(tree.remove(CopyCounted(i)));
+    }
+    std::vector<CopyCounted> batch;
+    for (int i = 0; i < 1000; ++i) {
+        batch.emplace_back(i * 13 % 1000 * 2 + 1);
+    }
+    tree.insert_batch(std::move(batch));
+    EXPECT_EQ(tree.size(), 2500);
+    EXPECT_EQ(CopyCounted::copies, 0);
+
+    batch.clear();
+    batch.emplace_back(5);
+    tree.insert_batch(batch);
+    EXPECT_EQ(CopyCounted::copies, 1);
+}
+
+struct Record {
+    int key;
+    std::unique_ptr<std::string> payload;
+
+    friend bool operator<(Record const &a, Record const &b) noexcept { return a.key < b.key; }
+};
+
+TEST(KeyLifetimeSuite, MoveOnlyKeys) {
+    b_tree::BTree<Record, 2> tree;
+    static_assert(!std::is_copy_constructible_v<decltype(tree)>);
+    for (int i = 0; i < 300; ++i) {
+        tree.insert(Record{i * 7 % 300, std::make_unique<std::string>(std::to_string(i * 7 % 300))});
+    }
+    tree.emplace(300, std::make_unique<std::string>("300"));
+    for (int i = 0; i < 300; i += 3) {
+        EXPECT_TRUE(tree.remove(Record{i, nullptr}));
+    }
+    std::vector<Record> batch;
+    for (int i = 301; i < 400; ++i) {
+        batch.push_back({i, std::make_unique<std::string>(std::to_string(i))});
+    }
+    tree.insert_batch(std::move(batch));
+    EXPECT_EQ(tree.size(), 300);
+    for (auto const &record: tree) {
+        EXPECT_EQ(*record.payload, std::to_string(record.key));
+    }
+
+    std::vector<Record> sorted;
+    for (int i = 0; i < 100; ++i) {
+        sorted.push_back({i, std::make_unique<std::string>(std::to_string(i))});
+    }
+    tree.assign_sorted(std::move(sorted));
+    EXPECT_EQ(tree.size(), 100);
+    EXPECT_EQ(*tree.find(Record{42, nullptr})->payload, "42");
+
+    auto moved = std::move(tree);
+    EXPECT_TRUE(moved.contains(Record{99, nullptr}));
+}
+
+// Owns heap memory, so it is not trivially copyable, but can be moved with
+// memmove all the same.
+class Relocatable {
+public:
+    explicit Relocatable(int value) : value_(std::make_unique<int>(value)) { ++alive; }
+
+    Relocatable(Relocatable &&other) noexcept : value_(std::move(other.value_)) { ++alive; }
+
+    Relocatable &operator=(Relocatable &&other) noexcept = default;
+
+    ~Relocatable() { --alive; }
+
+    friend bool operator<(Relocatable const &a, Relocatable const &b) noexcept { return *a.value_ < *b.value_; }
+
+    [[nodiscard]] int value() const { return *value_; }
+
+    static inline long alive = 0;
+
+private:
+    std::unique_ptr<int> value_;
+};
+
+template<>
+struct b_tree::is_trivially_relocatable<Relocatable> : std::true_type {};
+
+TEST(KeyLifetimeSuite, TriviallyRelocatableKeys) {
+    static_assert(b_tree::is_trivially_relocatable_v<int>);
+    static_assert(!b_tree::is_trivially_relocatable_v<std::string>);
+    Relocatable::alive = 0;
+    {
+        b_tree::BTree<Relocatable, 3> tree;
+        for (int i = 0; i < 1000; ++i) {
+            tree.emplace(i * 7 % 1000);
+        }
+        for (int i = 0; i < 1000; i += 2) {
+            EXPECT_TRUE(tree.remove(Relocatable(i)));
+        }
+        EXPECT_EQ(Relocatable::alive, 500);
+        int expected = 1;
+        for (auto const &value: tree) {
+            EXPECT_EQ(value.value(), expected);
+            expected += 2;
+        }
+    }
+    EXPECT_EQ(Relocatable::alive, 0);
+}
@@ -0,0 +1,86 @@
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "b_plus_tree.h"
+#include "b_tree.h"
+
+namespace {
+
+// Values from both ends of the range of T and around zero, where flipping
+// the sign bit of unsigned keys matters.
+template<typename T>
+std::vector<T> edge_values() {
+    std::vector<T> values;
+    std::mt19937_64 random(7);
+    for (int i = 0; i < 200; ++i) {
+        values.push_back(static_cast<T>(i - 100));
+        values.push_back(static_cast<T>(std::numeric_limits<T>::max() - static_cast<T>(i)));
+        values.push_back(static_cast<T>(std::numeric_limits<T>::lowest() + static_cast<T>(i)));
+        values.push_back(static_cast<T>(random()));
+    }
+    return values;
+}
+
+template<typename Tree>
+void expect_search_matches() {
+    using T = std::remove_cvref_t<decltype(*std::declval<Tree>().begin())>;
+    Tree tree;
+    std::multiset<T> set;
+    auto const values = edge_values<T>();
+    for (size_t i = 0; i < values.size(); i += 2) {
+        tree.insert(values[i]);
+        set.insert(values[i]);
+    }
+    for (T value: values) {
+        EXPECT_EQ(tree.contains(value), set.contains(value));
+        EXPECT_EQ(std::distance(tree.lower_bound(value), tree.end()),
+                  std::distance(set.lower_bound(value), set.end()));
+        EXPECT_EQ(std::distance(tree.upper_bound(value), tree.end()),
+                  std::distance(set.upper_bound(value), set.end()));
+    }
+}
+
+}  // namespace
+
+TEST(KeySearchSuite, SignedKeys) {
+    expect_search_matches<b_tree::BTree<int32_t, 64>>();
+    expect_search_matches<b_tree::BTree<int64_t, 16>>();
+    expect_search_matches<b_tree::BPlusTree<int64_t, 64>>();
+}
+
+TEST(KeySearchSuite, UnsignedKeys) {
+    expect_search_matches<b_tree::BTree<uint32_t, 64>>();
+    expect_search_matches<b_tree::BTree<uint64_t, 3>>();
+    expect_search_matches<b_tree::BPlusTree<uint32_t, 16>>();
+}
+
+TEST(KeySearchSuite, FloatingPointKeys) {
+    expect_search_matches<b_tree::BTree<float, 64>>();
+    expect_search_matches<b_tree::BTree<double, 64, std::less<double>>>();
+    expect_search_matches<b_tree::BPlusTree<double, 5>>();
+}
+
+// Prefetches however small the tree is.
+struct always_prefetch_policy : b_tree::cache_line_policy {
+    static constexpr size_t prefetch_min_bytes = 0;
+};
+
+TEST(KeySearchSuite, CacheLinePolicy) {
+    expect_search_matches<b_tree::BTree<int64_t, 64, std::less<>, std::allocator<int64_t>, b_tree::cache_line_policy>>();
+    expect_search_matches<b_tree::BTree<int64_t, 64, std::less<>, std::allocator<int64_t>, always_prefetch_policy>>();
+
+    b_tree::BTree<std::string, 16, std::less<>, std::allocator<std::string>, always_prefetch_policy> tree;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(std::to_string(i));
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        EXPECT_TRUE(tree.remove(std::to_string(i)));
+    }
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(tree.contains(std::to_string(i)), i % 2 == 1);
+    }
+}
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "gtest/gtest.h"
+#include "b_tree.h"
+
+using CountedTree = b_tree::BTree<int, 3, std::less<>, std::allocator<int>, b_tree::order_statistics_policy>;
+
+TEST(OrderStatisticsSuite, Size) {
+    b_tree::BTree<int, 2> tree;
+    EXPECT_EQ(tree.size(), 0u);
+    for (int i = 0; i < 100; ++i) {
+        tree.insert(i % 10);
+    }
+    EXPECT_EQ(tree.size(), 100u);
+    EXPECT_TRUE(tree.remove(3));
+    EXPECT_FALSE(tree.remove(42));
+    EXPECT_EQ(tree.size(), 99u);
+    tree.insert_batch(std::vector<int>{1, 2, 3});
+    EXPECT_EQ(tree.size(), 102u);
+    EXPECT_EQ(tree.erase_batch(std::vector<int>{1, 50}), 1u);
+    EXPECT_EQ(tree.size(), 101u);
+
+    auto copy = tree;
+    EXPECT_EQ(copy.size(), 101u);
+    auto moved = std::move(copy);
+    EXPECT_EQ(moved.size(), 101u);
+    tree.clear();
+    EXPECT_EQ(tree.size(), 0u);
+    tree.assign_sorted(std::vector<int>{1, 2, 2});
+    EXPECT_EQ(tree.size(), 3u);
+}
+
+TEST(OrderStatisticsSuite, RankAndNth) {
+    CountedTree tree;
+    std::vector<int> values;
+    for (int i = 0; i < 3000; ++i) {
+        int value = i * 37 % 1000;
+        tree.insert(value);
+        values.push_back(value);
+    }
+    std::sort(values.begin(), values.end());
+    for (int value = -1; value <= 1000; value += 7) {
+        auto expected = std::lower_bound(values.begin(), values.end(), value) - values.begin();
+        EXPECT_EQ(tree.rank(value), static_cast<size_t>(expected));
+    }
+    for (size_t i = 0; i < values.size(); i += 11) {
+        EXPECT_EQ(*tree.nth(i), values[i]);
+    }
+    EXPECT_EQ(tree.nth(values.size()), tree.end());
+    auto it = tree.nth(1500);
+    for (size_t i = 1500; i < 1600; ++i, ++it) {
+        EXPECT_EQ(*it, values[i]);
+    }
+}
+
+TEST(OrderStatisticsSuite, CountRange) {
+    CountedTree tree;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(i);
+    }
+    EXPECT_EQ(tree.count_range(100, 200), 100u);
+    EXPECT_EQ(tree.count_range(-50, 50), 50u);
+    EXPECT_EQ(tree.count_range(990, 5000), 10u);
+    EXPECT_EQ(tree.count_range(200, 100), 0u);
+    EXPECT_EQ(tree.count_range(5, 5), 0u);
+}
+
+TEST(OrderStatisticsSuite, CountsSurviveUpdates) {
+    std::mt19937 gen(3);
+    CountedTree tree;
+    std::vector<int> values;
+    for (int round = 0; round < 100; ++round) {
+        std::vector<int> batch(std::uniform_int_distribution<int>(0, 100)(gen));
+        for (auto &value: batch) {
+            value = std::uniform_int_distribution<int>(0, 500)(gen);
+        }
+        if (round % 4 == 0) {
+            tree.erase_batch(batch);
+            for (int value: batch) {
+                auto found = std::lower_bound(values.begin(), values.end(), value);
+                if (found != values.end() && *found == value) values.erase(found);
+            }
+        } else if (round % 4 == 1) {
+            for (int value: batch) {
+                tree.remove(value);
+                auto found = std::lower_bound(values.begin(), values.end(), value);
+                if (found != values.end() && *found == value) values.erase(found);
+            }
+        } else {
+            tree.insert_batch(batch);
+            values.insert(values.end(), batch.begin(), batch.end());
+            std::sort(values.begin(), values.end());
+        }
+        ASSERT_EQ(tree.size(), values.size());
+        for (int value = 0; value <= 500; value += 25) {
+            auto expected = std::lower_bound(values.begin(), values.end(), value) - values.begin();
+            EXPECT_EQ(tree.rank(value), static_cast<size_t>(expected));
+        }
+        if (!values.empty()) {
+            EXPECT_EQ(*tree.nth(values.size() / 2), values[values.size() / 2]);
+        }
+    }
+}
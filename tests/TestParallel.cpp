@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include "gtest/gtest.h"
+#include "b_tree.h"
+#include "node_pool.h"
+
+namespace {
+
+// Throws on the copy that makes throw_at reach 0, counts live instances.
+// Gets copied on several threads at once.
+struct Fragile {
+    Fragile(int value) : value(value) { ++alive; }
+
+    Fragile(Fragile const &other) : value(other.value) {
+        if (--throw_at == 0) throw std::runtime_error("copy");
+        ++alive;
+    }
+
+    Fragile &operator=(Fragile const &) = default;
+
+    ~Fragile() { --alive; }
+
+    friend bool operator<(Fragile const &a, Fragile const &b) { return a.value < b.value; }
+
+    int value;
+
+    static inline std::atomic<long> alive = 0;
+    static inline std::atomic<long> throw_at = -1;
+};
+
+std::vector<int> iota(int count) {
+    std::vector<int> values(count);
+    std::iota(values.begin(), values.end(), 0);
+    return values;
+}
+
+}  // namespace
+
+TEST(ParallelSuite, BuildMatchesSerialBuild) {
+    for (int count: {0, 1, 1000, 20000, 100001}) {
+        for (double fill_factor: {1.0, 0.5}) {
+            auto const values = iota(count);
+            b_tree::BTree<int, 3, std::less<>, std::allocator<int>, b_tree::order_statistics_policy>
+                    serial(b_tree::from_sorted, values.begin(), values.end(), fill_factor);
+            b_tree::BTree<int, 3, std::less<>, std::allocator<int>, b_tree::order_statistics_policy>
+                    parallel(b_tree::from_sorted, b_tree::parallel_t{4}, values.begin(), values.end(), fill_factor);
+            EXPECT_EQ(parallel.size(), serial.size());
+            EXPECT_TRUE(std::equal(parallel.begin(), parallel.end(), serial.begin(), serial.end()));
+            for (int i = 0; i < count; i += 997) {
+                EXPECT_EQ(*parallel.nth(i), i);
+            }
+        }
+    }
+}
+
+TEST(ParallelSuite, CloneAndClear) {
+    auto const values = iota(200000);
+    b_tree::BTree<int, 8> tree;
+    tree.assign_sorted(b_tree::parallel, values);
+    auto copy = tree.clone(b_tree::parallel);
+    EXPECT_EQ(copy.size(), values.size());
+    EXPECT_TRUE(std::equal(copy.begin(), copy.end(), values.begin(), values.end()));
+    for (int i = 0; i < 200000; i += 2) {
+        EXPECT_TRUE(copy.remove(i));
+    }
+    EXPECT_EQ(tree.size(), values.size());
+    EXPECT_TRUE(tree.contains(0));
+    tree.clear(b_tree::parallel_t{3});
+    EXPECT_TRUE(tree.empty());
+    EXPECT_EQ(tree.begin(), tree.end());
+    copy.assign_sorted(b_tree::parallel, iota(100000), 0.5);
+    EXPECT_EQ(copy.size(), 100000);
+    EXPECT_TRUE(std::is_sorted(copy.begin(), copy.end()));
+    copy.clear(b_tree::parallel);
+    EXPECT_TRUE(copy.empty());
+}
+
+TEST(ParallelSuite, ThrowingBuildLeavesTreeAlone) {
+    {
+        std::vector<Fragile> values;
+        for (int i = 0; i < 50000; ++i) {
+            values.emplace_back(i);
+        }
+        b_tree::BTree<Fragile, 4> tree;
+        tree.insert(Fragile(-1));
+        Fragile::throw_at = 30000;
+        EXPECT_THROW(tree.assign_sorted(b_tree::parallel, values), std::runtime_error);
+        Fragile::throw_at = -1;
+        EXPECT_EQ(Fragile::alive, 50001);
+        EXPECT_EQ(tree.size(), 1);
+        tree.assign_sorted(b_tree::parallel, values);
+        EXPECT_EQ(tree.size(), 50000);
+        tree.clear(b_tree::parallel);
+    }
+    EXPECT_EQ(Fragile::alive, 0);
+}
+
+// Pools are not thread-safe, so the parallel operations run on the calling
+// thread.
+TEST(ParallelSuite, PoolAllocatorStaysOnOneThread) {
+    auto const values = iota(50000);
+    b_tree::BTree<int, 4, std::less<>, b_tree::PoolAllocator<int>> tree(b_tree::from_sorted, b_tree::parallel,
+                                                                        values.begin(), values.end());
+    auto copy = tree.clone(b_tree::parallel);
+    EXPECT_TRUE(std::equal(copy.begin(), copy.end(), values.begin(), values.end()));
+    copy.clear(b_tree::parallel);
+    EXPECT_TRUE(copy.empty());
+    EXPECT_EQ(tree.size(), values.size());
+}
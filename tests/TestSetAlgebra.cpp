@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "gtest/gtest.h"
+#include "b_tree.h"
+#include "node_pool.h"
+#include "test_helpers.h"
+
+namespace {
+
+std::multiset<int> random_keys(std::mt19937 &random, int count, int low, int high) {
+    std::multiset<int> keys;
+    for (int i = 0; i < count; ++i) {
+        keys.insert(low + static_cast<int>(random() % (high - low)));
+    }
+    return keys;
+}
+
+template<typename Tree>
+void random_set_algebra() {
+    std::mt19937 random(3);
+    for (int round = 0; round < 30; ++round) {
+        int const low = static_cast<int>(random() % 2000);
+        auto const a = random_keys(random, static_cast<int>(random() % 3000), 0, 2000);
+        auto const b = random_keys(random, static_cast<int>(random() % 3000), low, low + 1000);
+        auto const left = make_tree<Tree>(a);
+        auto const right = make_tree<Tree>(b);
+
+        std::multiset<int> expected;
+        std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::inserter(expected, expected.end()));
+        expect_same_keys(set_union(left, right), expected);
+        expected.clear();
+        std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::inserter(expected, expected.end()));
+        expect_same_keys(set_intersection(left, right), expected);
+        expected.clear();
+        std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::inserter(expected, expected.end()));
+        expect_same_keys(set_difference(left, right), expected);
+
+        auto merged = left;
+        merged.merge(Tree(right));
+        expected = a;
+        expected.insert(b.begin(), b.end());
+        expect_same_keys(merged, expected);
+        merged.insert(-1);
+        EXPECT_EQ(*merged.begin(), -1);
+        expect_same_keys(left, a);
+        expect_same_keys(right, b);
+    }
+}
+
+}  // namespace
+
+TEST(SetAlgebraSuite, RandomTrees) {
+    random_set_algebra<b_tree::BTree<int, 2>>();
+}
+
+TEST(SetAlgebraSuite, RandomTreesCounted) {
+    using Tree = b_tree::BTree<int, 3, std::less<>, std::allocator<int>, b_tree::order_statistics_policy>;
+    random_set_algebra<Tree>();
+    auto const merged = set_union(make_tree<Tree>({1, 3, 5, 5}), make_tree<Tree>({2, 5, 6}));
+    EXPECT_EQ(*merged.nth(3), 5);
+    EXPECT_EQ(merged.rank(6), 5);
+}
+
+TEST(SetAlgebraSuite, RandomTreesCopyOnWrite) {
+    random_set_algebra<b_tree::BTree<int, 2, std::less<>, std::allocator<int>, b_tree::copy_on_write_policy>>();
+}
+
+TEST(SetAlgebraSuite, DisjointTrees) {
+    std::multiset<int> low, high;
+    for (int i = 0; i < 10000; ++i) {
+        low.insert(i / 2);
+        high.insert(5000 + i);
+    }
+    auto const lower = make_tree<b_tree::BTree<int, 3>>(low);
+    auto const upper = make_tree<b_tree::BTree<int, 3>>(high);
+    auto all = low;
+    all.insert(high.begin(), high.end());
+    expect_same_keys(set_union(lower, upper), all);
+    expect_same_keys(set_union(upper, lower), all);
+    EXPECT_TRUE(set_intersection(lower, upper).empty());
+    expect_same_keys(set_difference(upper, lower), high);
+
+    // Ranges that only touch still have the key they share in common.
+    auto const touching = make_tree<b_tree::BTree<int, 3>>({4999, 5000, 5000});
+    expect_same_keys(set_intersection(touching, upper), {5000});
+    auto const touching_union = set_union(touching, upper);
+    EXPECT_EQ(touching_union.size(), high.size() + 2);
+    EXPECT_EQ(std::count(touching_union.begin(), touching_union.end(), 5000), 2);
+
+    auto tree = lower;
+    tree.merge(b_tree::BTree<int, 3>(upper));
+    expect_same_keys(tree, all);
+    tree = upper;
+    tree.merge(b_tree::BTree<int, 3>(lower));
+    expect_same_keys(tree, all);
+    tree.merge(b_tree::BTree<int, 3>());
+    expect_same_keys(tree, all);
+}
+
+TEST(SetAlgebraSuite, MergeKeepsEqualKeysInOrder) {
+    b_tree::BTree<std::pair<int, std::string>, 2, decltype([](auto const &a, auto const &b) {
+        return a.first < b.first;
+    })> left, right;
+    for (int i = 0; i < 1000; ++i) {
+        left.insert(std::make_pair(i % 10, std::string("left")));
+        right.insert(std::make_pair(i % 10, std::string("right")));
+    }
+    left.merge(std::move(right));
+    EXPECT_TRUE(right.empty());
+    EXPECT_EQ(left.size(), 2000);
+    for (auto it = left.begin(); it != left.end(); std::advance(it, 200)) {
+        EXPECT_TRUE(std::all_of(it, std::next(it, 100), [](auto const &key) { return key.second == "left"; }));
+        EXPECT_TRUE(std::all_of(std::next(it, 100), std::next(it, 200),
+                                [](auto const &key) { return key.second == "right"; }));
+    }
+}
+
+// Trees with pools of their own cannot take each other's nodes.
+TEST(SetAlgebraSuite, PoolsOfTheirOwn) {
+    using Tree = b_tree::BTree<int, 4, std::less<>, b_tree::PoolAllocator<int>>;
+    std::mt19937 random(4);
+    auto const a = random_keys(random, 5000, 0, 3000);
+    auto const b = random_keys(random, 5000, 1000, 4000);
+    auto tree = make_tree<Tree>(a);
+    tree.merge(make_tree<Tree>(b));
+    auto expected = a;
+    expected.insert(b.begin(), b.end());
+    expect_same_keys(tree, expected);
+    auto const difference = set_difference(tree, make_tree<Tree>(b));
+    expect_same_keys(difference, a);
+}
+
+// Trees with pools of their own whose key ranges do not overlap get their
+// union built into a pool of its own, not joined, which separate pools
+// cannot be. Copy-on-write trees sharing a pool get theirs joined.
+TEST(SetAlgebraSuite, DisjointPools) {
+    using Tree = b_tree::BTree<int, 4, std::less<>, b_tree::PoolAllocator<int>>;
+    using SharingTree = b_tree::BTree<int, 4, std::less<>, b_tree::PoolAllocator<int>, b_tree::copy_on_write_policy>;
+    std::multiset<int> low, high;
+    for (int i = 0; i < 5000; ++i) {
+        low.insert(i);
+        high.insert(5000 + i);
+    }
+    auto all = low;
+    all.insert(high.begin(), high.end());
+
+    auto const lower = make_tree<Tree>(low);
+    auto const upper = make_tree<Tree>(high);
+    for (auto const &result: {set_union(lower, upper), set_union(upper, lower)}) {
+        expect_same_keys(result, all);
+        EXPECT_NE(result.get_allocator(), lower.get_allocator());
+        EXPECT_NE(result.get_allocator(), upper.get_allocator());
+    }
+    expect_same_keys(set_difference(upper, lower), high);
+    EXPECT_TRUE(set_intersection(lower, upper).empty());
+    auto tree = lower;
+    tree.merge(Tree(upper));
+    expect_same_keys(tree, all);
+
+    auto const shared_lower = make_tree<SharingTree>(low);
+    auto const shared_upper = make_tree<SharingTree>(high);
+    expect_same_keys(set_union(shared_upper, shared_lower), all);
+
+    b_tree::PoolAllocator<int> const pool;
+    SharingTree pooled_lower(pool);
+    SharingTree pooled_upper(pool);
+    for (int key: all) {
+        (key < 5000 ? pooled_lower : pooled_upper).insert(key);
+    }
+    auto const joined = set_union(pooled_lower, pooled_upper);
+    expect_same_keys(joined, all);
+    EXPECT_EQ(joined.get_allocator(), pool);
+}
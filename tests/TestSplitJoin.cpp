@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "gtest/gtest.h"
+#include "b_tree.h"
+#include "node_pool.h"
+#include "test_helpers.h"
+
+namespace {
+
+using CountedTree = b_tree::BTree<int, 2, std::less<>, std::allocator<int>, b_tree::order_statistics_policy>;
+
+// Runs out of memory at every allocation split and join make in turn.
+// Whatever they leave behind must free all its nodes, and snapshots keep
+// their keys.
+template<typename Policy>
+void split_and_join_out_of_memory() {
+    using Tree = b_tree::BTree<int, 2, std::less<>, FailingAllocator<int>, Policy>;
+    AllocationState state;
+    for (long budget = 0;; ++budget) {
+        {
+            Tree tree{FailingAllocator<int>(&state)};
+            for (int key = 0; key < 3000; ++key) {
+                tree.insert(key);
+            }
+            Tree const snapshot = tree;
+            state.budget = budget;
+            try {
+                auto [lower, upper] = std::move(tree).split(1234);
+                state.budget = -1;
+                expect_same_keys(lower, make_set(0, 1234));
+                expect_same_keys(upper, make_set(1234, 3000));
+                break;
+            } catch (std::bad_alloc const &) {
+                state.budget = -1;
+                // Copy-on-write trees may fail before cutting anything.
+                if (!tree.empty()) expect_same_keys(tree, make_set(0, 3000));
+                expect_same_keys(snapshot, make_set(0, 3000));
+            }
+        }
+        EXPECT_EQ(state.live, 0);
+    }
+    EXPECT_EQ(state.live, 0);
+
+    for (long budget = 0;; ++budget) {
+        {
+            Tree lower{FailingAllocator<int>(&state)};
+            Tree upper{FailingAllocator<int>(&state)};
+            for (int key = 0; key < 3000; ++key) {
+                (key < 10 ? lower : upper).insert(key);
+            }
+            state.budget = budget;
+            try {
+                auto const joined = join(std::move(lower), std::move(upper));
+                state.budget = -1;
+                expect_same_keys(joined, make_set(0, 3000));
+                break;
+            } catch (std::bad_alloc const &) {
+                state.budget = -1;
+                EXPECT_TRUE(lower.empty());
+                EXPECT_TRUE(upper.empty());
+            }
+        }
+        EXPECT_EQ(state.live, 0);
+    }
+}
+
+}  // namespace
+
+TEST(SplitJoinSuite, SplitAnywhere) {
+    for (int key: {-5, 0, 1, 2500, 9998, 9999, 10000, 20000}) {
+        auto tree = make_tree<b_tree::BTree<int, 3>>(0, 10000);
+        auto [lower, upper] = std::move(tree).split(key);
+        EXPECT_TRUE(tree.empty());
+        int const middle = std::clamp(key, 0, 10000);
+        expect_same_keys(lower, make_set(0, middle));
+        expect_same_keys(upper, make_set(middle, 10000));
+        lower.insert(-1);
+        upper.insert(20000);
+        EXPECT_EQ(lower.size(), middle + 1);
+        EXPECT_EQ(upper.size(), 10000 - middle + 1);
+    }
+}
+
+TEST(SplitJoinSuite, EqualKeysGoUpper) {
+    b_tree::BTree<int, 2> tree;
+    std::multiset<int> expected;
+    for (int i = 0; i < 3000; ++i) {
+        tree.insert(i % 10);
+        expected.insert(i % 10);
+    }
+    auto [lower, upper] = std::move(tree).split(4);
+    expect_same_keys(lower, std::multiset<int>(expected.begin(), expected.lower_bound(4)));
+    expect_same_keys(upper, std::multiset<int>(expected.lower_bound(4), expected.end()));
+    auto joined = join(std::move(lower), std::move(upper));
+    expect_same_keys(joined, expected);
+}
+
+TEST(SplitJoinSuite, JoinTreesOfAnyHeights) {
+    for (int small: {0, 1, 5, 100, 3000}) {
+        auto joined = join(make_tree<CountedTree>(0, small), make_tree<CountedTree>(small, 20000));
+        expect_same_keys(joined, make_set(0, 20000));
+        joined = join(make_tree<CountedTree>(-20000, 0), make_tree<CountedTree>(0, small));
+        expect_same_keys(joined, make_set(-20000, small));
+        for (int i = 0; i < 20000 + small; i += 101) {
+            EXPECT_EQ(*joined.nth(static_cast<size_t>(i)), i - 20000);
+        }
+    }
+}
+
+// Shards that get split and joined back into other shards keep their keys
+// and counts.
+TEST(SplitJoinSuite, Repartition) {
+    std::mt19937 random(5);
+    std::vector<CountedTree> shards;
+    shards.push_back(make_tree<CountedTree>(0, 50000));
+    for (int round = 0; round < 200; ++round) {
+        size_t const index = random() % shards.size();
+        if (shards.size() == 1 || random() % 2 == 0) {
+            int const low = shards[index].empty() ? 0 : *shards[index].begin();
+            int const high = shards[index].empty() ? 1 : *shards[index].rbegin() + 1;
+            auto [lower, upper] = std::move(shards[index]).split(low + static_cast<int>(random() % (high - low)));
+            shards[index] = std::move(upper);
+            shards.insert(shards.begin() + static_cast<std::ptrdiff_t>(index), std::move(lower));
+        } else {
+            size_t const next = index + 1 == shards.size() ? index - 1 : index + 1;
+            size_t const first = std::min(index, next);
+            shards[first] = join(std::move(shards[first]), std::move(shards[first + 1]));
+            shards.erase(shards.begin() + static_cast<std::ptrdiff_t>(first) + 1);
+        }
+    }
+    CountedTree all;
+    for (auto &shard: shards) {
+        for (size_t i = 0; i < shard.size(); i += 97) {
+            EXPECT_EQ(shard.rank(*shard.nth(i)), i);
+        }
+        all = join(std::move(all), std::move(shard));
+    }
+    expect_same_keys(all, make_set(0, 50000));
+}
+
+TEST(SplitJoinSuite, SnapshotsKeepTheirKeys) {
+    using Tree = b_tree::BTree<int, 2, std::less<>, std::allocator<int>, b_tree::copy_on_write_policy>;
+    auto tree = make_tree<Tree>(0, 5000);
+    auto const snapshot = tree;
+    auto [lower, upper] = std::move(tree).split(2000);
+    lower.insert(-1);
+    auto joined = join(std::move(upper), make_tree<Tree>(5000, 6000));
+    expect_same_keys(snapshot, make_set(0, 5000));
+    expect_same_keys(joined, make_set(2000, 6000));
+    EXPECT_EQ(lower.size(), 2001);
+}
+
+TEST(SplitJoinSuite, OutOfMemory) {
+    split_and_join_out_of_memory<b_tree::default_policy>();
+    split_and_join_out_of_memory<b_tree::order_statistics_policy>();
+    split_and_join_out_of_memory<b_tree::copy_on_write_policy>();
+}
+
+// Trees with pools of their own cannot take each other's nodes, trees
+// sharing a pool can.
+TEST(SplitJoinSuite, PoolsOfTheirOwn) {
+    using Tree = b_tree::BTree<int, 4, std::less<>, b_tree::PoolAllocator<int>>;
+    auto left = make_tree<Tree>(0, 1000);
+    auto right = make_tree<Tree>(1000, 3000);
+    EXPECT_THROW(static_cast<void>(join(std::move(left), std::move(right))), std::invalid_argument);
+    expect_same_keys(left, make_set(0, 1000));
+    expect_same_keys(right, make_set(1000, 3000));
+
+    b_tree::PoolAllocator<int> const pool;
+    Tree lower(pool);
+    Tree upper(pool);
+    for (int key = 0; key < 3000; ++key) {
+        (key < 1000 ? lower : upper).insert(key);
+    }
+    auto joined = join(std::move(lower), std::move(upper));
+    expect_same_keys(joined, make_set(0, 3000));
+    EXPECT_EQ(joined.get_allocator(), pool);
+    std::tie(lower, upper) = std::move(joined).split(1500);
+    EXPECT_EQ(lower.get_allocator(), upper.get_allocator());
+    joined = join(std::move(lower), std::move(upper));
+    expect_same_keys(joined, make_set(0, 3000));
+}
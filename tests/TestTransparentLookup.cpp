@@ -0,0 +1,100 @@
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "gtest/gtest.h"
+#include "b_plus_tree.h"
+#include "b_tree.h"
+#include "b_tree_map.h"
+
+namespace {
+
+// Counts the Names made from strings, which lookups should not make.
+struct Name {
+    Name(std::string_view value) : value(value) { ++made; }
+
+    std::string value;
+
+    static inline int made = 0;
+};
+
+struct NameLess {
+    using is_transparent = void;
+
+    bool operator()(Name const &a, Name const &b) const noexcept { return a.value < b.value; }
+
+    bool operator()(Name const &a, std::string_view b) const noexcept { return a.value < b; }
+
+    bool operator()(std::string_view a, Name const &b) const noexcept { return a < b.value; }
+
+    bool operator()(std::string_view a, std::string_view b) const noexcept { return a < b; }
+};
+
+std::string name_of(int i) {
+    return "name" + std::to_string(i);
+}
+
+}  // namespace
+
+TEST(TransparentLookupSuite, BTreeMakesNoKeys) {
+    b_tree::BTree<Name, 3, NameLess, std::allocator<Name>, b_tree::order_statistics_policy> tree;
+    for (int i = 0; i < 1000; i += 2) {
+        tree.insert(Name(name_of(i)));
+    }
+    for (int i = 0; i < 1000; ++i) {
+        std::string const name = name_of(i);
+        auto const lower = tree.lower_bound(Name(name));
+        auto const upper = tree.upper_bound(Name(name));
+        size_t const rank = tree.rank(Name(name));
+        Name::made = 0;
+        std::string_view const view = name;
+        EXPECT_EQ(tree.contains(view), i % 2 == 0);
+        EXPECT_EQ(tree.find(view) != tree.end(), i % 2 == 0);
+        EXPECT_EQ(tree.lower_bound(view), lower);
+        EXPECT_EQ(tree.upper_bound(view), upper);
+        EXPECT_EQ(tree.equal_range(view).second, upper);
+        EXPECT_EQ(tree.rank(view), rank);
+        EXPECT_EQ(Name::made, 0);
+    }
+    // name10, name12, ..., name18 and name100, name102, ..., name198.
+    EXPECT_EQ(tree.count_range(std::string_view("name1"), std::string_view("name2")), 55);
+    for (int i = 0; i < 1000; ++i) {
+        std::string const name = name_of(i);
+        EXPECT_EQ(tree.remove(std::string_view(name)), i % 2 == 0);
+    }
+    EXPECT_EQ(Name::made, 0);
+    EXPECT_TRUE(tree.empty());
+}
+
+TEST(TransparentLookupSuite, StringKeys) {
+    b_tree::BTree<std::string, 2> tree;
+    b_tree::BPlusTree<std::string, 2> plus_tree;
+    b_tree::BTreeMap<std::string, int, 2> map;
+    for (int i = 0; i < 100; ++i) {
+        tree.insert(name_of(i));
+        plus_tree.insert(name_of(i));
+        map[name_of(i)] = i;
+    }
+    EXPECT_TRUE(tree.contains("name42"));
+    EXPECT_TRUE(plus_tree.contains(std::string_view("name42")));
+    EXPECT_EQ(map.at("name42"), 42);
+    EXPECT_EQ((*map.find(std::string_view("name43"))).second, 43);
+    EXPECT_FALSE(tree.contains("name100"));
+    EXPECT_EQ(plus_tree.find("name100"), plus_tree.end());
+    EXPECT_EQ(map.lower_bound("name99"), --map.end());
+    EXPECT_TRUE(tree.remove("name42"));
+    EXPECT_TRUE(plus_tree.remove("name42"));
+    EXPECT_TRUE(map.remove("name42"));
+    EXPECT_FALSE(tree.contains("name42"));
+    EXPECT_FALSE(plus_tree.contains("name42"));
+    EXPECT_FALSE(map.contains("name42"));
+}
+
+TEST(TransparentLookupSuite, OpaqueComparatorConverts) {
+    b_tree::BTree<std::string, 2, std::less<std::string>> tree;
+    tree.insert("abc");
+    EXPECT_TRUE(tree.contains("abc"));
+    EXPECT_EQ(*tree.find("abc"), "abc");
+    EXPECT_TRUE(tree.remove("abc"));
+    EXPECT_TRUE(tree.empty());
+}
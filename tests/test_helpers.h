@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <set>
+#include "gtest/gtest.h"
+
+// Fixtures the test suites share: checking a tree's keys against a
+// std::multiset, filling trees, and an allocator that can run out.
+
+// Checks the keys of tree in both directions, and its size.
+template<typename Tree>
+void expect_same_keys(Tree const &tree, std::multiset<int> const &expected) {
+    EXPECT_EQ(tree.size(), expected.size());
+    EXPECT_TRUE(std::equal(tree.begin(), tree.end(), expected.begin(), expected.end()));
+    EXPECT_TRUE(std::equal(tree.rbegin(), tree.rend(), expected.rbegin(), expected.rend()));
+}
+
+template<typename Tree>
+Tree make_tree(std::multiset<int> const &keys) {
+    Tree tree;
+    for (int key: keys) {
+        tree.insert(key);
+    }
+    return tree;
+}
+
+// A tree of the keys [first, last), inserted in order.
+template<typename Tree>
+Tree make_tree(int first, int last) {
+    Tree tree;
+    for (int key = first; key < last; ++key) {
+        tree.insert(key);
+    }
+    return tree;
+}
+
+inline std::multiset<int> make_set(int first, int last) {
+    std::multiset<int> set;
+    for (int key = first; key < last; ++key) {
+        set.insert(key);
+    }
+    return set;
+}
+
+struct AllocationState {
+    long live = 0;
+    // Allocations left before they fail, or -1 for no limit.
+    long budget = -1;
+};
+
+// Allocates through std::allocator until the budget of its state runs
+// out, counting the blocks it has out.
+template<typename T>
+struct FailingAllocator {
+    using value_type = T;
+
+    explicit FailingAllocator(AllocationState *state) : state(state) {}
+
+    template<typename U>
+    FailingAllocator(FailingAllocator<U> const &other) : state(other.state) {}
+
+    T *allocate(size_t n) {
+        if (state->budget == 0) throw std::bad_alloc();
+        if (state->budget > 0) --state->budget;
+        ++state->live;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *p, size_t n) {
+        --state->live;
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    friend bool operator==(FailingAllocator const &a, FailingAllocator const &b) { return a.state == b.state; }
+
+    AllocationState *state;
+};